@@ -0,0 +1,138 @@
+#include <unistd.h>
+#include "audio_io.h"
+
+using namespace std;
+
+static string check_container(const SndfileHandle& sfh, bool allowRaw) {
+    if(sfh.error())
+        return "invalid input file";
+    if(allowRaw ? !is_wav_or_raw(sfh) : (sfh.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV)
+        return "file is not in WAV format";
+    return "";
+}
+
+string check_pcm16_wav(const SndfileHandle& sfh, bool allowRaw) {
+    string error = check_container(sfh, allowRaw);
+    if(error.empty() && (sfh.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16)
+        return "file is not in PCM_16 format";
+    return error;
+}
+
+string check_wav(const SndfileHandle& sfh, bool allowRaw) {
+    string error = check_container(sfh, allowRaw);
+    if(error.empty() && sample_bits(sfh.format()) == 0)
+        return "file is not in PCM_16, PCM_24, PCM_32 or FLOAT format";
+    return error;
+}
+
+//------------------------------------------------------------------------------
+// Stream mode
+//------------------------------------------------------------------------------
+bool StreamFormat::parse(const string& arg) {
+    size_t colon = arg.find(':');
+    if(colon == string::npos)
+        return false;
+    channels = atoi(arg.substr(0, colon).c_str());
+    samplerate = atoi(arg.substr(colon + 1).c_str());
+    raw = true;
+    return channels > 0 && samplerate > 0;
+}
+
+SndfileHandle open_input(const string& fileName, const StreamFormat& fmt) {
+    const int format = fmt.raw ? (SF_FORMAT_RAW | SF_FORMAT_PCM_16) : 0;
+    if(is_stdio(fileName))
+        return SndfileHandle(STDIN_FILENO, false, SFM_READ, format, fmt.channels, fmt.samplerate);
+    return SndfileHandle(fileName, SFM_READ, format, fmt.channels, fmt.samplerate);
+}
+
+SndfileHandle open_output(const string& fileName, const StreamFormat& fmt, int format, int channels, int samplerate) {
+    if(fmt.raw)
+        format = SF_FORMAT_RAW | SF_FORMAT_PCM_16;
+    if(is_stdio(fileName))
+        return SndfileHandle(STDOUT_FILENO, false, SFM_WRITE, format, channels, samplerate);
+    return SndfileHandle(fileName, SFM_WRITE, format, channels, samplerate);
+}
+
+void BlockLatency::report(ostream& os, size_t blockFrames, int samplerate) const {
+    double budget = static_cast<double>(blockFrames) / samplerate;
+    os << "Block latency: " << blocks << " blocks of " << blockFrames << " frames (budget "
+       << budget * 1e3 << " ms), worst " << worst * 1e3 << " ms, mean "
+       << (blocks ? total / blocks * 1e3 : 0.0) << " ms\n";
+}
+
+//------------------------------------------------------------------------------
+// Block reader
+//------------------------------------------------------------------------------
+template <typename T>
+BasicBlockReader<T>::BasicBlockReader(SndfileHandle& sfh, size_t blockFrames, BasicReaderBuffers<T>* buffers, bool prefetch)
+    : sfh(sfh), blockFrames(blockFrames), nChannels(static_cast<size_t>(sfh.channels())),
+      buffers(buffers ? *buffers : own), prefetch(prefetch) {
+    for(auto& b : this->buffers.slot)
+        b.resize(blockFrames * nChannels);
+    if(prefetch)
+        worker = thread(&BasicBlockReader::read_ahead, this);
+}
+
+template <typename T>
+BasicBlockReader<T>::~BasicBlockReader() {
+    if(worker.joinable()) {
+        {
+            lock_guard<mutex> lk(m);
+            stop = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+}
+
+// Reader thread: fills the slots alternately, each once the caller is done with it
+template <typename T>
+void BasicBlockReader<T>::read_ahead() {
+    for(int i = 0; ; i ^= 1) {
+        {
+            unique_lock<mutex> lk(m);
+            cv.wait(lk, [&] { return stop || !full[i]; });
+            if(stop)
+                return;
+        }
+        sf_count_t n = sfh.readf(buffers.slot[i].data(), static_cast<sf_count_t>(blockFrames));
+        {
+            lock_guard<mutex> lk(m);
+            frames[i] = n > 0 ? static_cast<size_t>(n) : 0;
+            full[i] = true;
+        }
+        cv.notify_all();
+        if(n <= 0)
+            return;
+    }
+}
+
+template <typename T>
+size_t BasicBlockReader<T>::next(T*& block) {
+    if(!prefetch) {
+        block = buffers.slot[0].data();
+        sf_count_t n = sfh.readf(block, static_cast<sf_count_t>(blockFrames));
+        return n > 0 ? static_cast<size_t>(n) : 0;
+    }
+
+    if(atEnd) {
+        block = buffers.slot[0].data();
+        return 0;
+    }
+
+    int i = current < 0 ? 0 : current ^ 1;
+    unique_lock<mutex> lk(m);
+    if(current >= 0) {
+        full[current] = false; // hand the previous block back to the reader thread
+        cv.notify_all();
+    }
+    cv.wait(lk, [&] { return full[i]; });
+    current = i;
+    block = buffers.slot[i].data();
+    atEnd = frames[i] == 0;
+    return frames[i];
+}
+
+template class BasicBlockReader<short>;
+template class BasicBlockReader<int>;
+template class BasicBlockReader<float>;
@@ -0,0 +1,251 @@
+#ifndef AUDIOIO_H
+#define AUDIOIO_H
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <sndfile.hh>
+#include "sample_traits.h"
+
+//------------------------------------------------------------------------------
+// Audio I/O shared by the sndfile-example tools (library "audio_io"): input
+// validation, stream mode, block reader/writer and aligned buffers
+//------------------------------------------------------------------------------
+
+// Returns the error message for an input that is not a PCM_16 WAV (or raw
+// PCM_16, if allowed), or an empty string if it is valid
+std::string check_pcm16_wav(const SndfileHandle& sfh, bool allowRaw = false);
+
+// Same for the inputs of the sample-format-generic tools: PCM_16, PCM_24,
+// PCM_32 or FLOAT
+std::string check_wav(const SndfileHandle& sfh, bool allowRaw = false);
+
+//------------------------------------------------------------------------------
+// Generic tools read every format natively (see sample_traits.h) and run the
+// kernels instantiated for its sample type:
+//   return with_sample_type(sample_type(sfh), [&](auto zero) {
+//       return run<decltype(zero)>(...);
+//   });
+//------------------------------------------------------------------------------
+enum class SampleType { Short, Int, Float }; // ordered by width
+
+inline SampleType sample_type(const SndfileHandle& sfh) {
+    switch(sfh.format() & SF_FORMAT_SUBMASK) {
+        case SF_FORMAT_PCM_24:
+        case SF_FORMAT_PCM_32: return SampleType::Int;
+        case SF_FORMAT_FLOAT:  return SampleType::Float;
+        default:               return SampleType::Short;
+    }
+}
+
+template <typename F>
+auto with_sample_type(SampleType type, F&& f) {
+    switch(type) {
+        case SampleType::Int:   return f(int{});
+        case SampleType::Float: return f(float{});
+        default:                return f(short{});
+    }
+}
+
+//------------------------------------------------------------------------------
+// Stream mode: "-" as a file name means stdin/stdout. Streams are WAV (as far
+// as libsndfile can write WAV to a pipe) or, with a raw format, headerless
+// PCM_16 in the machine's byte order, whose channels and sample rate must be
+// given by the user.
+//------------------------------------------------------------------------------
+struct StreamFormat {
+    bool raw = false;
+    int channels = 0;
+    int samplerate = 0;
+
+    // "-raw <channels>:<samplerate>"
+    bool parse(const std::string& arg);
+};
+
+inline bool is_stdio(const std::string& fileName) {
+    return fileName == "-";
+}
+
+SndfileHandle open_input(const std::string& fileName, const StreamFormat& fmt);
+SndfileHandle open_output(const std::string& fileName, const StreamFormat& fmt, int format, int channels, int samplerate);
+
+// Accepted input container: WAV, or raw PCM_16 in stream mode
+inline bool is_wav_or_raw(const SndfileHandle& sfh) {
+    int type = sfh.format() & SF_FORMAT_TYPEMASK;
+    return type == SF_FORMAT_WAV || type == SF_FORMAT_RAW;
+}
+
+//------------------------------------------------------------------------------
+// Worst-case and mean processing time per block, compared with the real-time
+// budget, i.e. the duration of the audio in one block
+//------------------------------------------------------------------------------
+class BlockLatency {
+  private:
+    std::chrono::steady_clock::time_point t0;
+    size_t blocks = 0;
+    double worst = 0.0; // seconds
+    double total = 0.0;
+
+  public:
+    void start() {
+        t0 = std::chrono::steady_clock::now();
+    }
+
+    void stop() {
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        worst = std::max(worst, t);
+        total += t;
+        blocks++;
+    }
+
+    void report(std::ostream& os, size_t blockFrames, int samplerate) const;
+};
+
+//------------------------------------------------------------------------------
+// Buffer aligned to a cache line (and to any SIMD width), reused across
+// blocks and files: resize() only reallocates when it grows
+//------------------------------------------------------------------------------
+template <typename T>
+class AlignedBuffer {
+  private:
+    static constexpr size_t ALIGNMENT = 64;
+
+    T* ptr = nullptr;
+    size_t count = 0;
+    size_t capacity = 0;
+
+  public:
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(size_t n) { resize(n); }
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+    ~AlignedBuffer() { std::free(ptr); }
+
+    // Contents are kept up to the old size
+    void resize(size_t n) {
+        if(n > capacity) {
+            size_t bytes = (n * sizeof(T) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            T* p = static_cast<T*>(std::aligned_alloc(ALIGNMENT, bytes));
+            if(!p)
+                throw std::bad_alloc();
+            if(ptr)
+                std::memcpy(p, ptr, count * sizeof(T));
+            std::free(ptr);
+            ptr = p;
+            capacity = n;
+        }
+        count = n;
+    }
+
+    T* data() { return ptr; }
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    T& operator[](size_t i) { return ptr[i]; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+    T* begin() { return ptr; }
+    T* end() { return ptr + count; }
+};
+
+//------------------------------------------------------------------------------
+// Block reader: interleaved blocks of a fixed number of frames, of any of the
+// sample types of sample_traits.h. With prefetching, a reader thread fills one
+// buffer while the caller works on the other, so decoding/disk time overlaps
+// processing. The handle must not be used by the caller while the reader
+// exists.
+//------------------------------------------------------------------------------
+template <typename T>
+struct BasicReaderBuffers {
+    AlignedBuffer<T> slot[2];
+};
+
+template <typename T>
+class BasicBlockReader {
+  private:
+    SndfileHandle& sfh;
+    size_t blockFrames;
+    size_t nChannels;
+    BasicReaderBuffers<T> own;
+    BasicReaderBuffers<T>& buffers;
+    bool prefetch;
+
+    // Prefetch state: slot i holds frames[i] frames when full[i]
+    std::thread worker;
+    std::mutex m;
+    std::condition_variable cv;
+    bool full[2] = { false, false };
+    size_t frames[2] = { 0, 0 };
+    bool stop = false;
+    int current = -1; // slot held by the caller
+    bool atEnd = false;
+
+    void read_ahead();
+
+  public:
+    // buffers: storage to reuse (e.g. one per thread of a batch), or nullptr
+    BasicBlockReader(SndfileHandle& sfh, size_t blockFrames, BasicReaderBuffers<T>* buffers = nullptr, bool prefetch = true);
+    BasicBlockReader(const BasicBlockReader&) = delete;
+    BasicBlockReader& operator=(const BasicBlockReader&) = delete;
+    ~BasicBlockReader();
+
+    // Next block (up to blockFrames frames; 0 at the end of the input). The
+    // block may be modified in place and stays valid until the next call.
+    size_t next(T*& block);
+
+    size_t channels() const { return nChannels; }
+    size_t block_frames() const { return blockFrames; }
+};
+
+extern template class BasicBlockReader<short>;
+extern template class BasicBlockReader<int>;
+extern template class BasicBlockReader<float>;
+
+using ReaderBuffers = BasicReaderBuffers<short>;
+using BlockReader = BasicBlockReader<short>;
+
+// Reader buffers of every sample type, for threads that may meet any format;
+// only the ones used are ever allocated
+struct AnyReaderBuffers {
+    BasicReaderBuffers<short> s16;
+    BasicReaderBuffers<int> s32;
+    BasicReaderBuffers<float> f32;
+
+    template <typename T>
+    BasicReaderBuffers<T>& get() {
+        if constexpr (std::is_same_v<T, short>) return s16;
+        else if constexpr (std::is_same_v<T, int>) return s32;
+        else return f32;
+    }
+};
+
+//------------------------------------------------------------------------------
+// Block writer: counts the frames written and remembers short writes
+//------------------------------------------------------------------------------
+class BlockWriter {
+  private:
+    SndfileHandle& sfh;
+    size_t written = 0;
+    bool failed = false;
+
+  public:
+    explicit BlockWriter(SndfileHandle& sfh) : sfh(sfh) {}
+
+    template <typename T>
+    void write(const T* block, size_t frames) {
+        sf_count_t n = sfh.writef(block, static_cast<sf_count_t>(frames));
+        written += n > 0 ? static_cast<size_t>(n) : 0;
+        failed = failed || n != static_cast<sf_count_t>(frames);
+    }
+
+    size_t frames() const { return written; }
+    bool ok() const { return !failed; }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "thread_pool.h"
+
+//------------------------------------------------------------------------------
+// Batch mode ("-batch list.txt"): the list has one job per line, an input file
+// and an output file separated by white space ('#' starts a comment). Jobs run
+// on a ThreadPool; the job function gets the index of its worker, so it can
+// reuse that worker's buffers and plans, and fills in a BatchResult.
+//------------------------------------------------------------------------------
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+struct BatchResult {
+    std::string error;   // empty: success
+    size_t frames = 0;
+    int samplerate = 0;
+    double seconds = 0.0; // processing time
+};
+
+inline bool read_batch_list(const std::string& fileName, std::vector<BatchJob>& jobs) {
+    std::ifstream in(fileName);
+    if(!in)
+        return false;
+
+    std::string line;
+    while(std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::stringstream fields(line);
+        BatchJob job;
+        if(fields >> job.input >> job.output)
+            jobs.push_back(job);
+    }
+    return true;
+}
+
+// fn(job, worker, result)
+template <typename JobFn>
+std::vector<BatchResult> run_batch(const std::vector<BatchJob>& jobs, ThreadPool& pool, JobFn fn) {
+    std::vector<BatchResult> results(jobs.size());
+    for(size_t i = 0; i < jobs.size(); i++)
+        pool.submit([&, i](unsigned worker) {
+            auto t0 = std::chrono::steady_clock::now();
+            fn(jobs[i], worker, results[i]);
+            results[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        });
+    pool.wait();
+    return results;
+}
+
+// One line per job, then totals; returns the number of failed jobs
+inline size_t print_batch_summary(std::ostream& os, const std::vector<BatchJob>& jobs,
+                                  const std::vector<BatchResult>& results, unsigned threads, double wallSeconds) {
+    size_t failed = 0;
+    double audioSeconds = 0.0;
+    os << "file\tframes\taudio (s)\ttime (s)\tstatus\n";
+    for(size_t i = 0; i < jobs.size(); i++) {
+        const BatchResult& r = results[i];
+        double audio = r.samplerate > 0 ? static_cast<double>(r.frames) / r.samplerate : 0.0;
+        os << jobs[i].input << '\t' << r.frames << '\t' << std::fixed << std::setprecision(2) << audio
+           << '\t' << std::setprecision(3) << r.seconds << '\t' << (r.error.empty() ? "ok" : r.error) << '\n';
+        if(r.error.empty())
+            audioSeconds += audio;
+        else
+            failed++;
+    }
+    os << jobs.size() - failed << " of " << jobs.size() << " files done in " << std::fixed << std::setprecision(3)
+       << wallSeconds << " s on " << threads << " threads (" << std::setprecision(1)
+       << (wallSeconds > 0 ? audioSeconds / wallSeconds : 0.0) << "x real time)\n";
+    os.unsetf(std::ios::floatfield);
+    os << std::setprecision(6);
+    return failed;
+}
+
+// Runs the jobs of a list file on a pool of "threads" workers and prints the
+// summary; returns the exit status of the program
+template <typename JobFn>
+int batch_main(const std::string& listFile, unsigned threads, JobFn fn) {
+    std::vector<BatchJob> jobs;
+    if(!read_batch_list(listFile, jobs)) {
+        std::cerr << "Error: cannot read batch list " << listFile << "\n";
+        return 1;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    ThreadPool pool(threads);
+    std::vector<BatchResult> results = run_batch(jobs, pool, fn);
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    return print_batch_summary(std::cout, jobs, results, pool.size(), wall) == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,425 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <memory>
+#include <filesystem>
+#include <functional>
+#include <sys/resource.h>
+#include <fftw3.h>
+#include <sndfile.hh>
+
+#include "../../bit_stream/src/bit_stream.h"
+#include "lloyd_max.h"
+#include "qnt_codec.h"
+#include "dct_codec.h"
+#include "wav_hist.h"
+#include "wav_cmp.h"
+#include "wav_effects.h"
+#include "audio_io.h"
+
+using namespace std;
+
+constexpr size_t FRAMES_BUFFER_SIZE = 65536;
+constexpr size_t EFFECT_BLOCK = 4096; // frames per block through the effect chain
+constexpr double PEAK = 0.5;          // peak of the generated signals (of full scale)
+
+//------------------------------------------------------------------------------
+// Synthetic signals, identical on every run and platform: the random numbers
+// come from a fixed-seed xorshift generator, not from <random>
+//------------------------------------------------------------------------------
+class XorShift {
+  private:
+    uint64_t s;
+
+  public:
+    explicit XorShift(uint64_t seed) : s(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    double uniform() { // [-1, 1)
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return static_cast<double>(s >> 11) * 0x1.0p-52 - 1.0;
+    }
+
+    double gaussian() { // sum of 4 uniforms, unit variance
+        return (uniform() + uniform() + uniform() + uniform()) * sqrt(0.75);
+    }
+};
+
+// Exponential sine sweep from 20 Hz to 0.45 fs, each channel in another phase
+static void gen_sweep(double* x, size_t frames, int channels, int fs) {
+    const double f0 = 20.0, f1 = 0.45 * fs;
+    const double T = static_cast<double>(frames) / fs;
+    const double L = T / log(f1 / f0);
+    for(size_t n = 0; n < frames; n++) {
+        double t = static_cast<double>(n) / fs;
+        double phase = 2.0 * M_PI * f0 * L * (exp(t / L) - 1.0);
+        for(int c = 0; c < channels; c++)
+            x[n * channels + c] = sin(phase + c * M_PI / 2.0);
+    }
+}
+
+static void gen_noise(double* x, size_t frames, int channels, int) {
+    XorShift rng(1);
+    for(size_t i = 0; i < frames * channels; i++)
+        x[i] = rng.gaussian();
+}
+
+static void gen_silence(double* x, size_t frames, int channels, int) {
+    fill(x, x + frames * channels, 0.0);
+}
+
+// Speech-like AR process: a glottal pulse train (about 120 Hz, with jitter)
+// or, in unvoiced segments, noise, through two second-order resonators
+// (formants) that drift slowly, gated by a 4 Hz syllabic envelope with pauses.
+// Channels share the source; the others get a small delay and their own noise.
+static void gen_speech(double* x, size_t frames, int channels, int fs) {
+    XorShift rng(2);
+    vector<double> y(frames);
+    double period = fs / 120.0, nextPulse = 0.0;
+    double y1[2] = { 0.0, 0.0 }, y2[2] = { 0.0, 0.0 };
+    for(size_t n = 0; n < frames; n++) {
+        double t = static_cast<double>(n) / fs;
+        size_t syllable = static_cast<size_t>(t * 4.0);
+        bool pause = syllable % 7 == 6;
+        bool voiced = syllable % 3 != 2;
+        double env = pause ? 0.0 : pow(sin(M_PI * (t * 4.0 - syllable)), 2.0);
+
+        double e;
+        if(voiced) {
+            e = 0.0;
+            if(n >= nextPulse) {
+                e = 1.0;
+                nextPulse += period * (1.0 + 0.02 * rng.uniform());
+            }
+            e += 0.02 * rng.gaussian();
+        } else {
+            e = 0.3 * rng.gaussian();
+        }
+
+        const double formants[2] = { 500.0 + 200.0 * sin(2.0 * M_PI * 0.7 * t),
+                                      1500.0 + 500.0 * sin(2.0 * M_PI * 0.3 * t) };
+        double v = e * env;
+        for(int k = 0; k < 2; k++) {
+            const double r = 0.995;
+            double a1 = 2.0 * r * cos(2.0 * M_PI * formants[k] / fs), a2 = -r * r;
+            double out = v + a1 * y1[k] + a2 * y2[k];
+            y2[k] = y1[k];
+            y1[k] = out;
+            v = out;
+        }
+        y[n] = v;
+    }
+    for(size_t n = 0; n < frames; n++)
+        for(int c = 0; c < channels; c++) {
+            size_t d = static_cast<size_t>(c) * 7; // frames of delay
+            x[n * channels + c] = (n >= d ? y[n - d] : 0.0) + (c ? 0.01 * rng.gaussian() : 0.0);
+        }
+}
+
+struct Signal {
+    const char* name;
+    void (*generate)(double*, size_t, int, int);
+};
+
+static const Signal SIGNALS[] = {
+    { "sweep", gen_sweep }, { "noise", gen_noise }, { "silence", gen_silence }, { "speech", gen_speech }
+};
+
+// Generates a signal as PCM_16, normalized to PEAK
+static vector<short> synthesize(const Signal& sig, size_t frames, int channels, int fs) {
+    vector<double> x(frames * channels);
+    sig.generate(x.data(), frames, channels, fs);
+    double peak = 0.0;
+    for(double v : x) peak = max(peak, fabs(v));
+    double gain = peak > 0.0 ? PEAK * 32768.0 / peak : 0.0;
+    vector<short> s(x.size());
+    for(size_t i = 0; i < x.size(); i++)
+        s[i] = to_sample<short>(x[i] * gain);
+    return s;
+}
+
+static bool write_wav(const string& fileName, const vector<short>& s, int channels, int fs) {
+    SndfileHandle sfh { fileName, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_PCM_16, channels, fs };
+    if(sfh.error()) return false;
+    return sfh.writef(s.data(), static_cast<sf_count_t>(s.size() / channels)) == static_cast<sf_count_t>(s.size() / channels);
+}
+
+//------------------------------------------------------------------------------
+// The codecs, run in-process on files with the encode/decode loops of the
+// tools (qnt_codec.h, dct_codec.h) and the same file formats, block sizes and
+// default parameters as wav_quant_enc/dec (8 bits, uniform and -lm),
+// dct_enc/dec, wav_hist, wav_cmp and wav_effects (echo:0.3:0.6,tremolo:5:0.5)
+//------------------------------------------------------------------------------
+constexpr int QNT_BITS = 8;
+
+static void qnt_encode(const string& inWav, const string& outQnt, bool lloydMax = false) {
+    LloydMaxQuantizer lm;
+    if(lloydMax) {
+        SndfileHandle sfTrain { inWav };
+        lm = LloydMaxQuantizer::train(sfTrain, QNT_BITS);
+    }
+
+    SndfileHandle sfIn { inWav };
+    fstream out(outQnt, ios::out | ios::binary | ios::trunc);
+    BitStream bs(out, STREAM_WRITE);
+    const QNTHeader h { static_cast<uint32_t>(sfIn.samplerate()), static_cast<uint16_t>(sfIn.channels()), QNT_BITS,
+                        static_cast<uint32_t>(sfIn.frames()), lloydMax };
+    write_qnt_header(bs, h, lm);
+    qnt_encode_samples(sfIn, bs, h, lm, nullptr, nullptr);
+    bs.close();
+}
+
+static void qnt_decode(const string& inQnt, const string& outWav) {
+    fstream in(inQnt, ios::in | ios::binary);
+    BitStream bs(in, STREAM_READ);
+    QNTHeader h;
+    LloydMaxQuantizer lm;
+    read_qnt_header(bs, h, lm);
+    SndfileHandle sfOut { outWav, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_PCM_16, h.channels, static_cast<int>(h.samplerate) };
+    BlockWriter writer(sfOut);
+    qnt_decode_samples(bs, h, lm, writer);
+}
+
+static void dct_encode(const string& inWav, const string& outDct) {
+    const DCTParams p;
+    SndfileHandle sfIn { inWav };
+    fstream fs(outDct, ios::binary | ios::out | ios::trunc);
+    BitStream bs(fs, STREAM_WRITE);
+    write_dct_header(bs, { static_cast<uint32_t>(sfIn.samplerate()), static_cast<uint32_t>(sfIn.frames()), p });
+
+    vector<double> x(p.blockSize);
+    vector<uint32_t> codes(p.keepK);
+    fftw_plan plan = fftw_plan_r2r_1d(static_cast<int>(p.blockSize), x.data(), x.data(), FFTW_REDFT10, FFTW_ESTIMATE);
+    dct_encode_blocks(sfIn, bs, p, plan, x.data(), codes.data(), nullptr, nullptr);
+    bs.close();
+    fftw_destroy_plan(plan);
+}
+
+static void dct_decode(const string& inDct, const string& outWav) {
+    fstream fs(inDct, ios::binary | ios::in);
+    BitStream bs(fs, STREAM_READ);
+    DCTHeader h;
+    read_dct_header(bs, h);
+    const DCTParams& p = h.params;
+
+    SndfileHandle sfOut { outWav, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_PCM_16, 1, static_cast<int>(h.samplerate) };
+    BlockWriter writer(sfOut);
+    vector<double> x(p.blockSize);
+    vector<uint32_t> codes(p.keepK);
+    AlignedBuffer<short> out(p.blockSize);
+    fftw_plan plan = fftw_plan_r2r_1d(static_cast<int>(p.blockSize), x.data(), x.data(), FFTW_REDFT01, FFTW_ESTIMATE);
+    dct_decode_blocks(bs, h, plan, x.data(), codes.data(), out.data(), writer);
+    fftw_destroy_plan(plan);
+}
+
+static void histogram(const string& inWav) {
+    SndfileHandle sfIn { inWav };
+    WAVHist hist { sfIn };
+    BlockReader reader { sfIn, FRAMES_BUFFER_SIZE };
+    short* block;
+    size_t frames;
+    while((frames = reader.next(block))) {
+        size_t count = frames * reader.channels();
+        hist.update(block, count);
+        if(reader.channels() == 2) {
+            hist.updateMid(block, count);
+            hist.updateSide(block, count);
+        }
+    }
+}
+
+// SNR (dB) of the whole file, over all channels
+static double compare(const string& origWav, const string& testWav) {
+    SndfileHandle sfOrig { origWav }, sfTest { testWav };
+    int channels = sfOrig.channels();
+    vector<Metrics<short>> perChannel(channels);
+    Metrics<short> mid;
+    BlockReader orig { sfOrig, FRAMES_BUFFER_SIZE }, test { sfTest, FRAMES_BUFFER_SIZE };
+    short *a, *b;
+    size_t frames;
+    while((frames = min(orig.next(a), test.next(b))))
+        accumulate_metrics(a, b, frames, channels, 1.0, perChannel, mid);
+    Metrics<short> all;
+    for(const auto& m : perChannel) all.add(m);
+    return static_cast<double>(snr_db(all));
+}
+
+static void effects(const string& inWav, const string& outWav) {
+    SndfileHandle sfIn { inWav };
+    int channels = sfIn.channels();
+    SndfileHandle sfOut { outWav, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_PCM_16, channels, sfIn.samplerate() };
+    EffectChain chain;
+    chain.add(make_unique<Echo>(channels, sfIn.samplerate(), 0.3, 0.6));
+    chain.add(make_unique<AmplitudeMod>(channels, sfIn.samplerate(), 5.0, 0.5));
+
+    BlockReader reader { sfIn, EFFECT_BLOCK };
+    BlockWriter writer(sfOut);
+    vector<float> x(EFFECT_BLOCK * channels);
+    short* block;
+    size_t frames;
+    while((frames = reader.next(block))) {
+        samples_to_float(block, x.data(), frames * channels);
+        chain.process(x.data(), frames);
+        float_to_samples(x.data(), block, frames * channels);
+        writer.write(block, frames);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Report: one line per signal and codec
+//------------------------------------------------------------------------------
+// Peak resident set size of the process so far (ru_maxrss): cumulative over
+// the rows printed before, not the memory of one case
+static double peak_rss_mb() {
+    rusage ru {};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0; // kB on Linux
+}
+
+static double timed_run(const function<void()>& f) {
+    auto t0 = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+struct Case {
+    string signal;
+    int channels;
+    double seconds;
+};
+
+static void print_row(const Case& c, const string& codec, double wall, size_t pcmBytes, double ratio, double snr) {
+    cout << c.signal << '\t' << c.channels << '\t' << fixed << setprecision(1) << c.seconds << '\t' << codec
+         << '\t' << setprecision(4) << wall << '\t' << setprecision(1) << (wall > 0 ? c.seconds / wall : 0.0)
+         << '\t' << (wall > 0 ? pcmBytes / wall / 1e6 : 0.0) << '\t';
+    if(ratio > 0) cout << setprecision(2) << ratio; else cout << '-';
+    cout << '\t';
+    if(isinf(snr)) cout << "inf";
+    else if(isnan(snr)) cout << '-';
+    else cout << setprecision(2) << snr;
+    cout << '\t' << setprecision(1) << peak_rss_mb() << '\n';
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+}
+
+static vector<double> parse_list(const string& arg) {
+    vector<double> v;
+    stringstream ss(arg);
+    string item;
+    while(getline(ss, item, ','))
+        if(!item.empty())
+            v.push_back(atof(item.c_str()));
+    return v;
+}
+
+int main(int argc, char* argv[]) {
+    vector<double> lengths { 1.0, 10.0, 60.0 };
+    vector<double> channelCounts { 1, 2 };
+    int samplerate = 44100;
+    string tmpDir = filesystem::temp_directory_path() / "codec_bench";
+    string writeDir;
+
+    for(int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if(a == "-h" || a == "--help") {
+            cerr << "Usage: codec_bench [ -quick ] [ -l seconds,... ] [ -c channels,... ] [ -r samplerate ] [ -tmp dir ]\n";
+            cerr << "       codec_bench [ -l seconds,... ] [ -c channels,... ] [ -r samplerate ] -write dir\n";
+            cerr << "  Runs the codecs on synthetic signals (sweep, noise, silence, speech) of each\n";
+            cerr << "  length (default 1,10,60) and channel count (default 1,2); dct: mono only.\n";
+            cerr << "  -quick: 1 s only\n";
+            cerr << "  -write dir: only write the signals, as <signal>_<channels>ch_<seconds>s.wav\n";
+            return 1;
+        }
+        if(a == "-quick") lengths = { 1.0 };
+        if(i + 1 < argc) {
+            if(a == "-l") lengths = parse_list(argv[i+1]);
+            if(a == "-c") channelCounts = parse_list(argv[i+1]);
+            if(a == "-r") samplerate = atoi(argv[i+1]);
+            if(a == "-tmp") tmpDir = argv[i+1];
+            if(a == "-write") writeDir = argv[i+1];
+        }
+    }
+    if(samplerate <= 0 || lengths.empty() || channelCounts.empty()) {
+        cerr << "Error: invalid sample rate, lengths or channel counts\n";
+        return 1;
+    }
+    for(double ch : channelCounts)
+        if(ch < 1 || ch > 8) {
+            cerr << "Error: channel counts must be between 1 and 8\n";
+            return 1;
+        }
+
+    const string dir = writeDir.empty() ? tmpDir : writeDir;
+    error_code ec;
+    filesystem::create_directories(dir, ec);
+    if(ec) {
+        cerr << "Error: cannot create directory " << dir << "\n";
+        return 1;
+    }
+
+    if(writeDir.empty())
+        cout << "signal\tch\taudio (s)\tcodec\ttime (s)\tx real time\tMB/s\tratio\tSNR (dB)\tpeak RSS so far (MB)\n";
+    for(double seconds : lengths)
+        for(double ch : channelCounts)
+            for(const Signal& sig : SIGNALS) {
+                const int channels = static_cast<int>(ch);
+                const size_t frames = static_cast<size_t>(seconds * samplerate);
+                const Case c { sig.name, channels, seconds };
+                ostringstream base;
+                base << dir << '/' << sig.name << '_' << channels << "ch_" << seconds << 's';
+                const string wav = base.str() + ".wav";
+
+                if(!write_wav(wav, synthesize(sig, frames, channels, samplerate), channels, samplerate)) {
+                    cerr << "Error: cannot write " << wav << "\n";
+                    return 1;
+                }
+                if(!writeDir.empty()) {
+                    cout << wav << "\n";
+                    continue;
+                }
+
+                const size_t pcmBytes = frames * channels * sizeof(short);
+                auto ratio = [&](const string& f) { return static_cast<double>(pcmBytes) / filesystem::file_size(f); };
+
+                const string qnt = base.str() + ".qnt", qntWav = base.str() + "_qnt.wav";
+                double tEnc = timed_run([&] { qnt_encode(wav, qnt); });
+                print_row(c, "wav_quant_enc", tEnc, pcmBytes, ratio(qnt), NAN);
+                double tDec = timed_run([&] { qnt_decode(qnt, qntWav); });
+                double snr = 0.0;
+                double tCmp = timed_run([&] { snr = compare(wav, qntWav); });
+                print_row(c, "wav_quant_dec", tDec, pcmBytes, ratio(qnt), snr);
+                print_row(c, "wav_cmp", tCmp, pcmBytes, 0.0, snr);
+
+                tEnc = timed_run([&] { qnt_encode(wav, qnt, true); });
+                print_row(c, "wav_quant_enc -lm", tEnc, pcmBytes, ratio(qnt), NAN);
+                tDec = timed_run([&] { qnt_decode(qnt, qntWav); });
+                print_row(c, "wav_quant_dec -lm", tDec, pcmBytes, ratio(qnt), compare(wav, qntWav));
+
+                if(channels == 1) {
+                    const string dct = base.str() + ".dct", dctWav = base.str() + "_dct.wav";
+                    tEnc = timed_run([&] { dct_encode(wav, dct); });
+                    print_row(c, "dct_enc", tEnc, pcmBytes, ratio(dct), NAN);
+                    tDec = timed_run([&] { dct_decode(dct, dctWav); });
+                    print_row(c, "dct_dec", tDec, pcmBytes, ratio(dct), compare(wav, dctWav));
+                    filesystem::remove(dct);
+                    filesystem::remove(dctWav);
+                }
+
+                double tHist = timed_run([&] { histogram(wav); });
+                print_row(c, "wav_hist", tHist, pcmBytes, 0.0, NAN);
+                const string fx = base.str() + "_fx.wav";
+                double tFx = timed_run([&] { effects(wav, fx); });
+                print_row(c, "wav_effects", tFx, pcmBytes, 0.0, NAN);
+
+                for(const string& f : { wav, qnt, qntWav, fx })
+                    filesystem::remove(f);
+            }
+    return 0;
+}
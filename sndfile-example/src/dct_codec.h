@@ -0,0 +1,207 @@
+#ifndef DCTCODEC_H
+#define DCTCODEC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <fftw3.h>
+#include <sndfile.hh>
+#include "../../bit_stream/src/bit_stream.h"
+#include "audio_io.h"
+#include "stats.h"
+
+//------------------------------------------------------------------------------
+// DCT1 format shared by dct_enc, dct_dec and codec_bench: a big-endian header, then for
+// every block of blockSize frames (the last one zero padded) the keepK
+// low-frequency DCT-II coefficients, each quantized with step qStep and
+// stored in coeffBits bits (two's complement)
+//------------------------------------------------------------------------------
+struct DCTParams{
+    size_t blockSize = 1024;  // N
+    size_t keepK = 256;       // K (low-frequency coefficients)
+    int coeffBits = 12;       // bits per quantized coefficient
+    float qStep = 8.0f;       // uniform quantization step
+};
+
+struct DCTHeader{
+    uint32_t samplerate = 0;
+    uint32_t totalFrames = 0;
+    DCTParams params;
+};
+
+inline uint32_t to_u32(int32_t v, int bits){
+    uint32_t mask = (bits >= 32) ? 0xFFFFFFFFu : ((1u << bits) - 1u);
+    return static_cast<uint32_t>(v) & mask;
+}
+
+inline int32_t sign_extend(uint32_t v, int bits){
+    if(bits == 32) return static_cast<int32_t>(v);
+    uint32_t m = 1u << (bits-1);
+    uint32_t mask = (1u<<bits) - 1u;
+    v &= mask;
+    if(v & m){
+        return static_cast<int32_t>(v | (~mask));
+    } else {
+        return static_cast<int32_t>(v);
+    }
+}
+
+inline void write_u32(BitStream &bs, uint32_t v){
+    bs.write_n_bits((v >> 24) & 0xFF, 8);
+    bs.write_n_bits((v >> 16) & 0xFF, 8);
+    bs.write_n_bits((v >> 8) & 0xFF, 8);
+    bs.write_n_bits((v) & 0xFF, 8);
+}
+
+inline void write_u16(BitStream &bs, uint16_t v){
+    bs.write_n_bits((v >> 8) & 0xFF, 8);
+    bs.write_n_bits((v) & 0xFF, 8);
+}
+
+inline void write_f32(BitStream &bs, float f){
+    static_assert(sizeof(float)==4, "float not 32-bit");
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    write_u32(bs, u);
+}
+
+inline uint32_t read_u32(BitStream &bs){
+    uint32_t b0 = static_cast<uint32_t>(bs.read_n_bits(8));
+    uint32_t b1 = static_cast<uint32_t>(bs.read_n_bits(8));
+    uint32_t b2 = static_cast<uint32_t>(bs.read_n_bits(8));
+    uint32_t b3 = static_cast<uint32_t>(bs.read_n_bits(8));
+    return (b0<<24) | (b1<<16) | (b2<<8) | b3;
+}
+
+inline uint16_t read_u16(BitStream &bs){
+    uint16_t b0 = static_cast<uint16_t>(bs.read_n_bits(8));
+    uint16_t b1 = static_cast<uint16_t>(bs.read_n_bits(8));
+    return static_cast<uint16_t>((b0<<8) | b1);
+}
+
+inline float read_f32(BitStream &bs){
+    uint32_t u = read_u32(bs);
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+inline void write_dct_header(BitStream &bs, const DCTHeader &h){
+    bs.write_string("DCT1");
+    write_u16(bs, 1);
+    write_u32(bs, h.samplerate);
+    write_u32(bs, h.totalFrames);
+    write_u16(bs, static_cast<uint16_t>(h.params.blockSize));
+    write_u16(bs, static_cast<uint16_t>(h.params.keepK));
+    write_u16(bs, static_cast<uint16_t>(h.params.coeffBits));
+    write_f32(bs, h.params.qStep);
+}
+
+// Returns an error message, or an empty string if the header is valid
+inline std::string read_dct_header(BitStream &bs, DCTHeader &h){
+    if(bs.read_string() != "DCT1") return "invalid file (magic)";
+    read_u16(bs); // version
+    h.samplerate = read_u32(bs);
+    h.totalFrames = read_u32(bs);
+    h.params.blockSize = read_u16(bs);
+    h.params.keepK = read_u16(bs);
+    h.params.coeffBits = read_u16(bs);
+    h.params.qStep = read_f32(bs);
+    if(h.params.keepK > h.params.blockSize) return "corrupt header: K>N";
+    return "";
+}
+
+// Quantized codes of the first keepK coefficients of an unnormalized
+// DCT-II (FFTW_REDFT10) of one block
+inline void dct_quantize(const double *x, uint32_t *codes, const DCTParams &p){
+    double scale = 1.0 / (static_cast<double>(p.blockSize) * 2.0);
+    for(size_t k=0;k<p.keepK;k++){
+        double ck = x[k] * scale;
+        int32_t q = static_cast<int32_t>( llround( ck / static_cast<double>(p.qStep) ) );
+        codes[k] = to_u32(q, p.coeffBits);
+    }
+}
+
+// Inverse of dct_quantize(): the input of the inverse DCT (FFTW_REDFT01),
+// with the coefficients that were not kept set to 0
+inline void dct_dequantize(const uint32_t *codes, double *x, const DCTParams &p){
+    for(size_t k=0;k<p.blockSize;k++) x[k]=0.0;
+    for(size_t k=0;k<p.keepK;k++){
+        int32_t q = sign_extend(codes[k], p.coeffBits);
+        x[k] = static_cast<double>(q) * static_cast<double>(p.qStep);
+    }
+}
+
+// Output sample of the inverse DCT, rounded and saturated to 16 bits
+inline short dct_to_sample(double v){
+    long s = lround(v);
+    if(s>32767) s=32767;
+    if(s<-32768) s=-32768;
+    return static_cast<short>(s);
+}
+
+constexpr size_t DCT_READ_FRAMES = 65536; // rounded up to a whole number of blocks
+
+// Codes of all the blocks of sfIn (mono PCM_16), a whole number of blocks
+// read at a time (the last one zero padded). "plan": an in-place FFTW_REDFT10
+// of blockSize made on x (blockSize doubles); codes: keepK. "buffers" may be
+// reused across files (nullptr: the reader's own), stage timings go to
+// "stats" (none if nullptr)
+inline void dct_encode_blocks(SndfileHandle &sfIn, BitStream &bs, const DCTParams &p, fftw_plan plan, double *x,
+                              uint32_t *codes, ReaderBuffers *buffers, Stats *stats){
+    const size_t chunkFrames = (DCT_READ_FRAMES + p.blockSize - 1) / p.blockSize * p.blockSize;
+    BlockReader reader{sfIn, chunkFrames, buffers};
+    short *samples;
+    size_t chunkLen;
+    while((chunkLen = timed(stats, Stage::Read, [&]{ return reader.next(samples); }))){
+        for(size_t start=0; start<chunkLen; start+=p.blockSize){
+            size_t len = std::min(p.blockSize, chunkLen - start);
+            {
+                StageTimer t(stats, Stage::Deinterleave);
+                for(size_t i=0;i<p.blockSize;i++){
+                    if(i < len) x[i] = static_cast<double>(samples[start + i]);
+                    else x[i] = 0.0;
+                }
+            }
+
+            // DCT-II
+            {
+                StageTimer t(stats, Stage::Transform);
+                fftw_execute_r2r(plan, x, x);
+            }
+            {
+                StageTimer t(stats, Stage::Quantize);
+                dct_quantize(x, codes, p);
+            }
+            StageTimer t(stats, Stage::BitPack);
+            for(size_t k=0;k<p.keepK;k++){
+                bs.write_n_bits(codes[k], p.coeffBits);
+            }
+        }
+    }
+}
+
+// Inverse of dct_encode_blocks(): the h.totalFrames frames of the payload.
+// "plan": an in-place FFTW_REDFT01 of blockSize made on x; codes: keepK;
+// out: blockSize samples
+inline void dct_decode_blocks(BitStream &bs, const DCTHeader &h, fftw_plan plan, double *x, uint32_t *codes,
+                              short *out, BlockWriter &writer){
+    const DCTParams &p = h.params;
+    size_t nBlocks = (static_cast<size_t>(h.totalFrames) + p.blockSize - 1) / p.blockSize;
+    for(size_t b=0;b<nBlocks;++b){
+        for(size_t k=0;k<p.keepK;k++){
+            codes[k] = static_cast<uint32_t>(bs.read_n_bits(p.coeffBits));
+        }
+        dct_dequantize(codes, x, p);
+        fftw_execute_r2r(plan, x, x);
+        for(size_t i=0;i<p.blockSize;i++){
+            out[i] = dct_to_sample(x[i]);
+        }
+        writer.write(out, std::min<size_t>(p.blockSize, h.totalFrames - b*p.blockSize));
+    }
+}
+
+#endif
@@ -4,137 +4,147 @@
 #include <cstdint>
 #include <fstream>
 #include <cstring>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
 #include <fftw3.h>
 #include <sndfile.hh>
 
 #include "../../bit_stream/src/bit_stream.h"
+#include "dct_codec.h"
+#include "batch.h"
+#include "audio_io.h"
+#include "stats.h"
+#include "scratch_arena.h"
 
 using namespace std;
 
-static inline uint32_t to_u32(int32_t v, int bits){
-    uint32_t mask = (bits >= 32) ? 0xFFFFFFFFu : ((1u << bits) - 1u);
-    return static_cast<uint32_t>(v) & mask;
-}
+// Read buffers, scratch memory (transform buffer, quantized coefficients of
+// one block) and plan of one thread, reused for every file of a batch
+struct DCTWorker{
+    ReaderBuffers buffers;
+    ScratchArena arena;
+    fftw_plan planD = nullptr;
 
-static inline int32_t from_u32(uint32_t u, int bits){
-    if(bits == 32) return static_cast<int32_t>(u);
-    uint32_t sign = 1u << (bits-1);
-    if(u & sign){
-        int32_t val = static_cast<int32_t>(u | (~((1u<<bits)-1u)));
-        return val;
-    } else {
-        return static_cast<int32_t>(u);
+    ~DCTWorker(){
+        if(planD) fftw_destroy_plan(planD);
     }
-}
+};
 
-static void write_u32(BitStream &bs, uint32_t v){
-    bs.write_n_bits((v >> 24) & 0xFF, 8);
-    bs.write_n_bits((v >> 16) & 0xFF, 8);
-    bs.write_n_bits((v >> 8) & 0xFF, 8);
-    bs.write_n_bits((v) & 0xFF, 8);
-}
+// Encodes one file; messages go to "log" and stage timings to "stats" (none if nullptr)
+static void encode_file(const BatchJob &job, const DCTParams &p, DCTWorker &w, Stats *stats, ostream *log, BatchResult &result){
+    const string &inWav = job.input;
+    const string &outBin = job.output;
 
-static void write_u16(BitStream &bs, uint16_t v){
-    bs.write_n_bits((v >> 8) & 0xFF, 8);
-    bs.write_n_bits((v) & 0xFF, 8);
-}
+    SndfileHandle sfIn{inWav};
+    result.error = check_pcm16_wav(sfIn);
+    if(!result.error.empty()) return;
+    if(sfIn.channels() != 1){
+        result.error = "mono only (1 channel)"; return;
+    }
 
-static void write_f32(BitStream &bs, float f){
-    static_assert(sizeof(float)==4, "float not 32-bit");
-    uint32_t u;
-    memcpy(&u, &f, sizeof(u));
-    write_u32(bs, u);
+    const size_t nFrames = static_cast<size_t>(sfIn.frames());
+    ScratchArena::Scope scope{w.arena};
+    double *x = w.arena.alloc<double>(p.blockSize);
+    uint32_t *codes = w.arena.alloc<uint32_t>(p.keepK);
+    if(!w.planD){
+        lock_guard<mutex> lk(fftw_planner_mutex());
+        w.planD = fftw_plan_r2r_1d(static_cast<int>(p.blockSize), x, x, FFTW_REDFT10, FFTW_ESTIMATE);
+    }
+
+    fstream fs(outBin, ios::binary | ios::out | ios::trunc);
+    if(!fs){ result.error = "cannot open output file"; return; }
+    BitStream bs(fs, STREAM_WRITE);
+
+    write_dct_header(bs, { static_cast<uint32_t>(sfIn.samplerate()), static_cast<uint32_t>(nFrames), p });
+
+    if(log){
+        *log << "Encoding " << inWav << " -> " << outBin << "\n";
+        *log << "Frames=" << nFrames << ", Fs=" << sfIn.samplerate() << ", N=" << p.blockSize
+             << ", K=" << p.keepK << ", bits/coeff=" << p.coeffBits << ", qStep=" << p.qStep << "\n";
+    }
+
+    dct_encode_blocks(sfIn, bs, p, w.planD, x, codes, &w.buffers, stats);
+
+    {
+        StageTimer t(stats, Stage::Flush);
+        bs.close();
+    }
+    const uint64_t nBlocks = (nFrames + p.blockSize - 1) / p.blockSize;
+    stats_count(stats, &Stats::files, 1);
+    stats_count(stats, &Stats::frames, nFrames);
+    stats_count(stats, &Stats::bytesIn, nFrames * sizeof(short));
+    stats_count(stats, &Stats::bitsOut, nBlocks * p.keepK * p.coeffBits);
+    stats_count(stats, &Stats::bytesOut, static_cast<uint64_t>(bs.tell()));
+    stats_set_max(stats, &Stats::scratchBytes, w.arena.high_water());
+    result.frames = nFrames;
+    result.samplerate = sfIn.samplerate();
 }
 
 int main(int argc, char* argv[]){
     bool verbose = false;
-    size_t blockSize = 1024;  // N
-    size_t keepK = 256;       // K (low-frequency coefficients)
-    int coeffBits = 12;       // bits per quantized coefficient
-    float qStep = 8.0f;       // uniform quantization step
+    DCTParams p;
+    string batchFile;
+    string statsFormat;
+    unsigned nThreads = max(1u, thread::hardware_concurrency());
 
     if(argc < 3){
-        cerr << "Usage: dct_enc [ -v ] [ -bs N ] [ -k K ] [ -b bits ] [ -q step ] input.wav output.dct\n";
+        cerr << "Usage: dct_enc [ -v ] [ --stats json ] [ -bs N ] [ -k K ] [ -b bits ] [ -q step ] input.wav output.dct\n";
+        cerr << "       dct_enc [ --stats json ] [ -j threads ] [ -bs N ] [ -k K ] [ -b bits ] [ -q step ] -batch list.txt\n";
+        cerr << "  list.txt: one 'input.wav output.dct' pair per line\n";
+        cerr << "  --stats json: per-stage times and counters, as JSON on stderr\n";
         return 1;
     }
 
     for(int i=1;i<argc;i++) if(string(argv[i])=="-v") verbose=true;
-    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-bs") blockSize = static_cast<size_t>(atoi(argv[i+1]));
-    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-k") keepK = static_cast<size_t>(atoi(argv[i+1]));
-    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-b") coeffBits = atoi(argv[i+1]);
-    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-q") qStep = static_cast<float>(atof(argv[i+1]));
-
-    string inWav = argv[argc-2];
-    string outBin = argv[argc-1];
-
-    if(keepK > blockSize){
+    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-bs") p.blockSize = static_cast<size_t>(atoi(argv[i+1]));
+    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-k") p.keepK = static_cast<size_t>(atoi(argv[i+1]));
+    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-b") p.coeffBits = atoi(argv[i+1]);
+    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-q") p.qStep = static_cast<float>(atof(argv[i+1]));
+    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-batch") batchFile = argv[i+1];
+    for(int i=1;i+1<argc;i++) if(string(argv[i])=="-j") nThreads = static_cast<unsigned>(max(1, atoi(argv[i+1])));
+    for(int i=1;i+1<argc;i++) if(string(argv[i])=="--stats") statsFormat = argv[i+1];
+
+    if(p.keepK > p.blockSize){
         cerr << "Error: K cannot exceed block size" << endl;
         return 1;
     }
-    if(coeffBits < 2 || coeffBits > 24){
+    if(p.coeffBits < 2 || p.coeffBits > 24){
         cerr << "Error: bits must be in [2,24]" << endl;
         return 1;
     }
 
-    SndfileHandle sfIn{inWav};
-    if(sfIn.error()){ cerr << "Error: invalid input file" << endl; return 1; }
-    if((sfIn.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV || (sfIn.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16){
-        cerr << "Error: input must be WAV PCM_16" << endl; return 1;
-    }
-    if(sfIn.channels() != 1){
-        cerr << "Error: mono only (1 channel)" << endl; return 1;
-    }
-
-    const size_t nFrames = static_cast<size_t>(sfIn.frames());
-    vector<short> samples(nFrames);
-    sfIn.readf(samples.data(), sfIn.frames());
-
-    size_t nBlocks = (nFrames + blockSize - 1) / blockSize;
-    vector<double> x(blockSize, 0.0);
-
-    fftw_plan planD = fftw_plan_r2r_1d(static_cast<int>(blockSize), x.data(), x.data(), FFTW_REDFT10, FFTW_ESTIMATE);
-
-    fstream fs(outBin, ios::binary | ios::out | ios::trunc);
-    if(!fs){ cerr << "Error: cannot open output file" << endl; return 1; }
-    BitStream bs(fs, STREAM_WRITE);
-
-    // Header
-    bs.write_string("DCT1");
-    write_u16(bs, 1);
-    write_u32(bs, static_cast<uint32_t>(sfIn.samplerate()));
-    write_u32(bs, static_cast<uint32_t>(nFrames));
-    write_u16(bs, static_cast<uint16_t>(blockSize));
-    write_u16(bs, static_cast<uint16_t>(keepK));
-    write_u16(bs, static_cast<uint16_t>(coeffBits));
-    write_f32(bs, qStep);
-
-    if(verbose){
-        cout << "Encoding " << inWav << " -> " << outBin << "\n";
-        cout << "Frames=" << nFrames << ", Fs=" << sfIn.samplerate() << ", N=" << blockSize
-             << ", K=" << keepK << ", bits/coeff=" << coeffBits << ", qStep=" << qStep << "\n";
+    if(!statsFormat.empty() && !parse_stats_format(statsFormat)){
+        cerr << "Error: --stats expects json" << endl;
+        return 1;
     }
 
-    // Process blocks
-    for(size_t b=0; b<nBlocks; ++b){
-        size_t start = b * blockSize;
-        size_t len = std::min(blockSize, nFrames - start);
-        for(size_t i=0;i<blockSize;i++){
-            if(i < len) x[i] = static_cast<double>(samples[start + i]);
-            else x[i] = 0.0;
-        }
-
-        // DCT-II
-        fftw_execute(planD);
-        double scale = 1.0 / (static_cast<double>(blockSize) * 2.0);
-        for(size_t k=0;k<keepK;k++){
-            double ck = x[k] * scale;
-            int32_t q = static_cast<int32_t>( llround( ck / static_cast<double>(qStep) ) );
-            uint32_t uq = to_u32(q, coeffBits);
-            bs.write_n_bits(uq, coeffBits);
+    auto t0 = chrono::steady_clock::now();
+    int status;
+    vector<Stats> stats(batchFile.empty() ? 1 : nThreads); // one per worker
+    auto statsOf = [&](unsigned worker){ return statsFormat.empty() ? nullptr : &stats[worker]; };
+    if(!batchFile.empty()){
+        vector<DCTWorker> workers(nThreads);
+        status = batch_main(batchFile, nThreads, [&](const BatchJob &job, unsigned worker, BatchResult &result){
+            encode_file(job, p, workers[worker], statsOf(worker), nullptr, result);
+        });
+    } else {
+        DCTWorker w;
+        BatchResult result;
+        encode_file({ argv[argc-2], argv[argc-1] }, p, w, statsOf(0), verbose ? &cout : nullptr, result);
+        if(!result.error.empty()){
+            cerr << "Error: " << result.error << endl;
+            return 1;
         }
+        status = 0;
     }
 
-    bs.close();
-    fftw_destroy_plan(planD);
-    return 0;
+    if(!statsFormat.empty()){
+        Stats total;
+        for(const Stats &s : stats) total.add(s);
+        double wall = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        total.write_json(cerr, "dct_enc", static_cast<unsigned>(stats.size()), wall);
+    }
+    return status;
 }
@@ -0,0 +1,99 @@
+#ifndef DOWNMIX_H
+#define DOWNMIX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "sample_traits.h"
+
+//------------------------------------------------------------------------------
+// Downmix of interleaved PCM_16 frames to mono (wav_to_mono). As in
+// interleave.h, the loops are instantiated for the usual channel counts, so
+// the stride is a constant and the compiler vectorizes them; other counts
+// take the generic loop.
+//------------------------------------------------------------------------------
+
+// Mean of the channels, rounded half away from zero: lround(sum / C) exactly.
+// The rounded quotient is floor((2|sum| + C) / 2C), and the division by 2C is
+// a multiplication by its fixed-point reciprocal M = ceil(2^32 / 2C), which is
+// exact as long as numerator * 2C < 2^32 (C <= 8: numerator < 2^20)
+constexpr uint64_t mean_reciprocal(size_t channels) {
+    return ((uint64_t(1) << 32) + 2 * channels - 1) / (2 * channels);
+}
+
+template <size_t C>
+inline void downmix_mean_n(const short* in, size_t frames, short* out) {
+    static_assert(C >= 2 && C <= 8, "reciprocal only exact up to 8 channels");
+    constexpr uint64_t M = mean_reciprocal(C);
+    for(size_t i = 0; i < frames; i++) {
+        int32_t sum = 0;
+        for(size_t c = 0; c < C; c++)
+            sum += in[i * C + c];
+        uint32_t a = static_cast<uint32_t>(sum < 0 ? -sum : sum);
+        int32_t q = static_cast<int32_t>((static_cast<uint64_t>(2 * a + C) * M) >> 32);
+        out[i] = static_cast<short>(sum < 0 ? -q : q); // |mean| <= 32768, and -32768 only if negative
+    }
+}
+
+inline void downmix_mean(const short* in, size_t channels, size_t frames, short* out) {
+    switch(channels) {
+        case 2: downmix_mean_n<2>(in, frames, out); break;
+        case 3: downmix_mean_n<3>(in, frames, out); break;
+        case 4: downmix_mean_n<4>(in, frames, out); break;
+        case 5: downmix_mean_n<5>(in, frames, out); break;
+        case 6: downmix_mean_n<6>(in, frames, out); break;
+        case 7: downmix_mean_n<7>(in, frames, out); break;
+        case 8: downmix_mean_n<8>(in, frames, out); break;
+        default:
+            for(size_t i = 0; i < frames; i++) {
+                int64_t sum = 0;
+                for(size_t c = 0; c < channels; c++)
+                    sum += in[i * channels + c];
+                int64_t a = sum < 0 ? -sum : sum;
+                int64_t q = (2 * a + static_cast<int64_t>(channels)) / (2 * static_cast<int64_t>(channels));
+                out[i] = static_cast<short>(sum < 0 ? -q : q);
+            }
+    }
+}
+
+// Weighted sum of the channels (a 1 x C downmix matrix), rounded half away
+// from zero and saturated
+template <size_t C>
+inline void downmix_weighted_n(const short* in, const float* w, size_t frames, short* out) {
+    for(size_t i = 0; i < frames; i++) {
+        float acc = 0.0f;
+        for(size_t c = 0; c < C; c++)
+            acc += in[i * C + c] * w[c];
+        out[i] = to_sample<short>(acc);
+    }
+}
+
+inline void downmix_weighted(const short* in, size_t channels, const float* w, size_t frames, short* out) {
+    switch(channels) {
+        case 2: downmix_weighted_n<2>(in, w, frames, out); break;
+        case 6: downmix_weighted_n<6>(in, w, frames, out); break;
+        case 8: downmix_weighted_n<8>(in, w, frames, out); break;
+        default:
+            for(size_t i = 0; i < frames; i++) {
+                float acc = 0.0f;
+                for(size_t c = 0; c < channels; c++)
+                    acc += in[i * channels + c] * w[c];
+                out[i] = to_sample<short>(acc);
+            }
+    }
+}
+
+// Mono downmix of 5.1 (WAV channel order L R C LFE Ls Rs) of ITU-R BS.775:
+// M = 0.7071 (L + R) + C + 0.5 (Ls + Rs), LFE dropped, scaled so the weights
+// sum to 1 and a full-scale signal in every channel does not clip
+inline std::vector<float> itu_51_weights() {
+    const double w[6] = { 0.70710678, 0.70710678, 1.0, 0.0, 0.5, 0.5 };
+    double total = 0.0;
+    for(double v : w) total += v;
+    std::vector<float> weights(6);
+    for(size_t c = 0; c < 6; c++)
+        weights[c] = static_cast<float>(w[c] / total);
+    return weights;
+}
+
+#endif
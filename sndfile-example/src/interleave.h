@@ -0,0 +1,61 @@
+#ifndef INTERLEAVE_H
+#define INTERLEAVE_H
+
+#include <cstddef>
+#include "sample_traits.h"
+
+//------------------------------------------------------------------------------
+// Interleaved frames (c1 c2 ... cn c1 c2 ... cn ...) of any sample type of
+// sample_traits.h <-> one array of doubles per channel. The loops are instantiated for the usual channel
+// counts (mono, stereo, 5.1, 7.1), so the stride is a constant and the
+// compiler vectorizes them; other counts take the generic loop.
+//------------------------------------------------------------------------------
+template <size_t C, typename T>
+inline void deinterleave_channel_n(const T* in, size_t c, size_t frames, double* out) {
+    const T* p = in + c;
+    for(size_t i = 0; i < frames; i++)
+        out[i] = p[i * C];
+}
+
+// Integers are rounded half away from zero, as round(), and saturated;
+// to_sample() does it without libm calls so that the loop vectorizes
+template <size_t C, typename T>
+inline void interleave_round_n(const double* const* in, size_t frames, T* out) {
+    for(size_t c = 0; c < C; c++) {
+        const double* p = in[c];
+        T* o = out + c;
+        for(size_t i = 0; i < frames; i++)
+            o[i * C] = to_sample<T>(p[i]);
+    }
+}
+
+// out[i] = channel c of frame i
+template <typename T>
+inline void deinterleave_channel(const T* in, size_t channels, size_t c, size_t frames, double* out) {
+    switch(channels) {
+        case 1: deinterleave_channel_n<1>(in, c, frames, out); break;
+        case 2: deinterleave_channel_n<2>(in, c, frames, out); break;
+        case 6: deinterleave_channel_n<6>(in, c, frames, out); break;
+        case 8: deinterleave_channel_n<8>(in, c, frames, out); break;
+        default:
+            for(size_t i = 0; i < frames; i++)
+                out[i] = in[i * channels + c];
+    }
+}
+
+// Frame i of out = in[0][i] in[1][i] ... in[channels-1][i], as samples of type T
+template <typename T>
+inline void interleave_round(const double* const* in, size_t channels, size_t frames, T* out) {
+    switch(channels) {
+        case 1: interleave_round_n<1>(in, frames, out); break;
+        case 2: interleave_round_n<2>(in, frames, out); break;
+        case 6: interleave_round_n<6>(in, frames, out); break;
+        case 8: interleave_round_n<8>(in, frames, out); break;
+        default:
+            for(size_t c = 0; c < channels; c++)
+                for(size_t i = 0; i < frames; i++)
+                    out[i * channels + c] = to_sample<T>(in[c][i]);
+    }
+}
+
+#endif
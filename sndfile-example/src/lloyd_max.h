@@ -0,0 +1,241 @@
+#ifndef LLOYDMAX_H
+#define LLOYDMAX_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <sndfile.hh>
+#include "../../bit_stream/src/bit_stream.h"
+#include "wav_quant.h"
+#include "audio_io.h"
+#include "stats.h"
+
+//------------------------------------------------------------------------------
+// Lloyd-Max quantizer of PCM_16 samples: 2^bits reconstruction levels trained
+// to minimize the squared error over a histogram of the signal (wav_hist.h),
+// with the decision thresholds halfway between them. Audio is roughly
+// Laplacian, so the levels crowd around 0, where the uniform levels of
+// quantize_sample() leave most samples far from any level.
+//
+// Quantization is one lookup in a table of codes indexed by the 65536 sample
+// values, so it costs no more than the uniform quantizer. QNT2 files
+// (wav_quant_enc -lm) store both tables after the QNT1 header fields.
+//------------------------------------------------------------------------------
+class LloydMaxQuantizer {
+  private:
+    static constexpr int VALUES = 65536;
+    static constexpr int OFFSET = 32768;
+    static constexpr int MAX_ITERATIONS = 200;
+    static constexpr size_t READ_FRAMES = 65536; // per block of train(SndfileHandle&)
+
+    std::vector<short> levels;     // 2^bits, strictly increasing
+    std::vector<short> thresholds; // 2^bits - 1: samples >= thresholds[i] get codes > i
+    std::vector<uint16_t> lut;     // code of every sample value, indexed by sample + 32768
+
+    // Halfway between the levels, ties to the upper one
+    void set_thresholds() {
+        thresholds.resize(levels.size() - 1);
+        for(size_t i = 0; i + 1 < levels.size(); i++)
+            thresholds[i] = static_cast<short>((levels[i] + levels[i + 1] + 1) >> 1);
+    }
+
+    void build_lut() {
+        lut.resize(VALUES);
+        uint16_t code = 0;
+        for(int v = 0; v < VALUES; v++) {
+            while(code < thresholds.size() && v - OFFSET >= thresholds[code])
+                code++;
+            lut[v] = code;
+        }
+    }
+
+    // Prefix sums of the histogram: samples and sum of the sample values
+    // below each value (exact, in integers)
+    struct Moments {
+        std::vector<uint64_t> count;
+        std::vector<int64_t> sum;
+        std::vector<uint64_t> dense;
+    };
+
+    static Moments moments(const std::vector<uint64_t>& dense) {
+        Moments m { std::vector<uint64_t>(VALUES + 1), std::vector<int64_t>(VALUES + 1), dense };
+        for(int v = 0; v < VALUES; v++) {
+            m.count[v + 1] = m.count[v] + m.dense[v];
+            m.sum[v + 1] = m.sum[v] + static_cast<int64_t>(m.dense[v]) * (v - OFFSET);
+        }
+        return m;
+    }
+
+    // Squared error over the histogram
+    double mse(const Moments& m) const {
+        double total = 0.0;
+        for(int v = 0; v < VALUES; v++) {
+            if(!m.dense[v])
+                continue;
+            double e = v - OFFSET - levels[lut[v]];
+            total += e * e * static_cast<double>(m.dense[v]);
+        }
+        return total;
+    }
+
+    // Lloyd iterations: every level moves to the centroid (rounded) of its
+    // cell until none moves. Centroids stay inside their cells, so the levels
+    // stay strictly increasing; levels of empty cells do not move.
+    void lloyd(const Moments& m) {
+        for(int it = 0; it < MAX_ITERATIONS; it++) {
+            set_thresholds();
+            bool moved = false;
+            for(size_t i = 0; i < levels.size(); i++) {
+                int lo = (i == 0 ? -OFFSET : thresholds[i - 1]) + OFFSET;
+                int hi = i + 1 == levels.size() ? VALUES : thresholds[i] + OFFSET;
+                int64_t n = static_cast<int64_t>(m.count[hi] - m.count[lo]);
+                if(n == 0)
+                    continue;
+                int64_t s = m.sum[hi] - m.sum[lo];
+                short c = static_cast<short>((2 * s + (s >= 0 ? n : -n)) / (2 * n)); // rounded s / n
+                moved |= c != levels[i];
+                levels[i] = c;
+            }
+            if(!moved)
+                break;
+        }
+        set_thresholds();
+        build_lut();
+    }
+
+    // Level i at the (i + 1/2) / 2^bits quantile of the histogram raised to
+    // "exponent" (1: equal probability per cell; 1/3: the asymptotically
+    // optimal spacing of Panter and Dite, closer to the result for many
+    // levels), spread so the levels are strictly increasing within the range
+    static LloydMaxQuantizer quantiles(const Moments& m, int bits, double exponent) {
+        std::vector<double> cumulative(VALUES + 1);
+        for(int v = 0; v < VALUES; v++)
+            cumulative[v + 1] = cumulative[v] + std::pow(static_cast<double>(m.dense[v]), exponent);
+
+        LloydMaxQuantizer q;
+        const size_t L = size_t(1) << bits;
+        q.levels.resize(L);
+        int v = 0;
+        for(size_t i = 0; i < L; i++) {
+            double target = (i + 0.5) * cumulative[VALUES] / L;
+            while(v < VALUES - 1 && cumulative[v + 1] <= target)
+                v++;
+            int level = std::max(v - OFFSET, i ? q.levels[i - 1] + 1 : -OFFSET);
+            q.levels[i] = static_cast<short>(std::min(level, OFFSET - static_cast<int>(L - i)));
+        }
+        return q;
+    }
+
+  public:
+    static constexpr int MAX_BITS = 12; // tables of at most 16 KB in QNT2 headers
+
+    LloydMaxQuantizer() = default;
+
+    // Uniform levels: the quantizer of quantize_sample()/sample_to_code()
+    static LloydMaxQuantizer uniform(int bits) {
+        LloydMaxQuantizer q;
+        q.levels.resize(size_t(1) << bits);
+        for(size_t c = 0; c < q.levels.size(); c++)
+            q.levels[c] = code_to_sample(static_cast<uint32_t>(c), bits);
+        q.set_thresholds();
+        q.build_lut();
+        return q;
+    }
+
+    // Trained on the counts of the 65536 sample values (indexed by sample +
+    // 32768, all channels pooled), starting from the uniform levels and from
+    // both quantile spacings; the result with the lowest error is kept (the
+    // uniform levels included), so it is never worse than uniform
+    // quantization on the training data
+    static LloydMaxQuantizer train(const std::vector<uint64_t>& dense, int bits) {
+        const Moments m = moments(dense);
+        LloydMaxQuantizer best = uniform(bits);
+        if(m.count[VALUES] == 0)
+            return best;
+        double bestError = best.mse(m);
+        for(LloydMaxQuantizer q : { uniform(bits), quantiles(m, bits, 1.0), quantiles(m, bits, 1.0 / 3.0) }) {
+            q.lloyd(m);
+            double error = q.mse(m);
+            if(error < bestError) {
+                best = std::move(q);
+                bestError = error;
+            }
+        }
+        return best;
+    }
+
+    // Trained on a histogram of wav_hist.h (e.g. WAVHist::getChannelCounts())
+    static LloydMaxQuantizer train(const std::map<short, size_t>& counts, int bits) {
+        std::vector<uint64_t> dense(VALUES);
+        for(auto [value, counter] : counts)
+            dense[value + OFFSET] += counter;
+        return train(dense, bits);
+    }
+
+    // Trained on all the samples of a PCM_16 file, read to the end (the first
+    // pass of a two-pass encoder: reopen the file for the second one).
+    // "buffers" may be reused across files (nullptr: the reader's own), stage
+    // timings go to "stats" (none if nullptr)
+    static LloydMaxQuantizer train(SndfileHandle& sfIn, int bits, ReaderBuffers* buffers = nullptr,
+                                   Stats* stats = nullptr) {
+        std::vector<uint64_t> dense(VALUES);
+        {
+            BlockReader reader { sfIn, READ_FRAMES, buffers };
+            short* block;
+            size_t frames;
+            while((frames = timed(stats, Stage::Read, [&] { return reader.next(block); }))) {
+                StageTimer t(stats, Stage::Quantize);
+                for(size_t i = 0; i < frames * reader.channels(); i++)
+                    dense[block[i] + OFFSET]++;
+            }
+        }
+        StageTimer t(stats, Stage::Quantize);
+        return train(dense, bits);
+    }
+
+    int bits() const {
+        int b = 0;
+        while((size_t(1) << b) < levels.size())
+            b++;
+        return b;
+    }
+
+    uint16_t code(short s) const { return lut[s + OFFSET]; }
+    short sample(uint32_t code) const { return levels[code]; }
+
+    void quantize_block(const short* in, uint16_t* codes, size_t n) const {
+        const uint16_t* table = lut.data() + OFFSET;
+        for(size_t i = 0; i < n; i++)
+            codes[i] = table[in[i]];
+    }
+
+    // Tables of QNT2 headers: the levels, then the thresholds (16 bits each)
+    void write(BitStream& bs) const {
+        for(short l : levels)
+            bs.write_n_bits(static_cast<uint16_t>(l), 16);
+        for(short t : thresholds)
+            bs.write_n_bits(static_cast<uint16_t>(t), 16);
+    }
+
+    // False if the tables are inconsistent
+    bool read(BitStream& bs, int bits) {
+        if(bits < 1 || bits > MAX_BITS)
+            return false;
+        levels.resize(size_t(1) << bits);
+        thresholds.resize(levels.size() - 1);
+        for(short& l : levels)
+            l = static_cast<short>(static_cast<uint16_t>(bs.read_n_bits(16)));
+        for(short& t : thresholds)
+            t = static_cast<short>(static_cast<uint16_t>(bs.read_n_bits(16)));
+        for(size_t i = 0; i + 1 < levels.size(); i++)
+            if(levels[i] >= levels[i + 1] || thresholds[i] <= levels[i] || thresholds[i] > levels[i + 1])
+                return false;
+        build_lut();
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef QNTCODEC_H
+#define QNTCODEC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <algorithm>
+#include <sndfile.hh>
+#include "../../bit_stream/src/bit_stream.h"
+#include "wav_quant.h"
+#include "lloyd_max.h"
+#include "audio_io.h"
+#include "stats.h"
+
+//------------------------------------------------------------------------------
+// QNT formats shared by wav_quant_enc, wav_quant_dec and codec_bench: the
+// magic, samplerate (32 bits), channels (16), bits (8) and frames (32), then
+// the code of every sample in "bits" bits, interleaved. QNT1 codes are the
+// uniform levels of sample_to_code(); QNT2 files store the tables of a
+// LloydMaxQuantizer after the header and index its levels.
+//------------------------------------------------------------------------------
+struct QNTHeader {
+    uint32_t samplerate = 0;
+    uint16_t channels = 0;
+    int bits = 0;
+    uint32_t totalFrames = 0;
+    bool lloydMax = false; // QNT2
+};
+
+constexpr size_t QNT_BLOCK_FRAMES = 65536;
+
+// lm: the quantizer of QNT2 files (ignored for QNT1)
+inline void write_qnt_header(BitStream& bs, const QNTHeader& h, const LloydMaxQuantizer& lm) {
+    bs.write_string(h.lloydMax ? "QNT2" : "QNT1");
+    bs.write_n_bits(h.samplerate, 32);
+    bs.write_n_bits(h.channels, 16);
+    bs.write_n_bits(h.bits, 8);
+    bs.write_n_bits(h.totalFrames, 32);
+    if(h.lloydMax)
+        lm.write(bs);
+}
+
+// Returns an error message, or an empty string if the header is valid
+inline std::string read_qnt_header(BitStream& bs, QNTHeader& h, LloydMaxQuantizer& lm) {
+    std::string format = bs.read_string();
+    if(format != "QNT1" && format != "QNT2")
+        return "invalid input file format";
+    h.lloydMax = format == "QNT2";
+    h.samplerate = static_cast<uint32_t>(bs.read_n_bits(32));
+    h.channels = static_cast<uint16_t>(bs.read_n_bits(16));
+    h.bits = static_cast<int>(bs.read_n_bits(8));
+    h.totalFrames = static_cast<uint32_t>(bs.read_n_bits(32));
+    if(h.lloydMax && !lm.read(bs, h.bits))
+        return "invalid quantizer tables";
+    return "";
+}
+
+// Codes of all the samples of sfIn (PCM_16), block by block; "buffers" may be
+// reused across files (nullptr: the reader's own), stage timings go to
+// "stats" (none if nullptr)
+inline void qnt_encode_samples(SndfileHandle& sfIn, BitStream& bs, const QNTHeader& h, const LloydMaxQuantizer& lm,
+                               ReaderBuffers* buffers, Stats* stats) {
+    BlockReader reader { sfIn, QNT_BLOCK_FRAMES, buffers };
+    AlignedBuffer<uint16_t> codes(h.lloydMax ? QNT_BLOCK_FRAMES * reader.channels() : 0);
+    short* block;
+    size_t frames;
+    while((frames = timed(stats, Stage::Read, [&] { return reader.next(block); }))) {
+        size_t count = frames * reader.channels();
+        if(h.lloydMax) {
+            {
+                StageTimer t(stats, Stage::Quantize);
+                lm.quantize_block(block, codes.data(), count); // table lookup
+            }
+            StageTimer t(stats, Stage::BitPack);
+            for(size_t i = 0; i < count; i++)
+                bs.write_n_bits(codes[i], h.bits);
+            continue;
+        }
+        {
+            StageTimer t(stats, Stage::Quantize);
+            quantize_block(block, block, count, h.bits); // in place
+        }
+        StageTimer t(stats, Stage::BitPack);
+        for(size_t i = 0; i < count; i++)
+            bs.write_n_bits(sample_to_code(block[i], h.bits), h.bits);
+    }
+}
+
+// Inverse of qnt_encode_samples(): the h.totalFrames frames of the payload
+inline void qnt_decode_samples(BitStream& bs, const QNTHeader& h, const LloydMaxQuantizer& lm, BlockWriter& writer) {
+    AlignedBuffer<short> samples(QNT_BLOCK_FRAMES * h.channels);
+    for(size_t done = 0; done < h.totalFrames; ) {
+        size_t frames = std::min<size_t>(QNT_BLOCK_FRAMES, h.totalFrames - done);
+        for(size_t i = 0; i < frames * h.channels; i++) {
+            uint32_t code = static_cast<uint32_t>(bs.read_n_bits(h.bits));
+            samples[i] = h.lloydMax ? lm.sample(code) : code_to_sample(code, h.bits);
+        }
+        writer.write(samples.data(), frames);
+        done += frames;
+    }
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+#include "audio_io.h" // AlignedBuffer
+
+//------------------------------------------------------------------------------
+// Polyphase FIR sample-rate converter, outRate / inRate = L / M (reduced).
+// The input is (conceptually) upsampled by L, low-pass filtered and
+// downsampled by M; only the L phases of the filter that hit input samples
+// are ever evaluated. Output sample n is
+//   y[n] = sum_k h[p + k L] x[i - k],  t = n M + D, i = t / L, p = t % L
+// where D compensates the delay of the filter, so the output is aligned with
+// the input. The prototype h is a Kaiser-windowed sinc of L * Np taps
+// (80 dB stopband), with the transition band just below the Nyquist
+// frequency of the lower rate; each phase is stored reversed, so every output
+// sample is one inner product of Np contiguous floats per channel.
+//
+// Streams are fed block by block (interleaved float frames, see
+// samples_to_float() in sample_traits.h); the last Np - 1 input frames of each
+// channel are kept between blocks. flush() produces the outputs that depend
+// on the end of the input, up to ceil(inFrames * L / M) frames in total.
+//------------------------------------------------------------------------------
+class PolyphaseResampler {
+  private:
+    static constexpr size_t LANES = 8;         // accumulators of the inner product
+    static constexpr double ATTENUATION = 80.0; // stopband (dB)
+
+    int channels;
+    uint64_t L, M;
+    size_t Np;                    // taps per phase, a multiple of LANES
+    uint64_t D;                   // delay of the filter, in upsampled samples
+    AlignedBuffer<float> bank;    // [phase][Np], reversed
+    std::vector<AlignedBuffer<float>> history; // per channel: Np - 1 frames of history, then the block
+
+    uint64_t consumed = 0;        // input frames before the current block
+    uint64_t produced = 0;        // output frames so far
+    bool flushed = false;
+
+    static double bessel_i0(double x) {
+        double sum = 1.0, term = 1.0;
+        for(int k = 1; k < 50; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // L / M = outRate / inRate, reduced
+    static void ratio(int inRate, int outRate, uint64_t& L, uint64_t& M) {
+        uint64_t g = std::gcd(static_cast<uint64_t>(inRate), static_cast<uint64_t>(outRate));
+        L = static_cast<uint64_t>(outRate) / g;
+        M = static_cast<uint64_t>(inRate) / g;
+    }
+
+    // Np of the constructor: taps, scaled by M / L when downsampling, rounded
+    // up to a multiple of LANES
+    static size_t phase_taps(uint64_t L, uint64_t M, size_t taps) {
+        double perPhase = std::ceil(taps * std::max(1.0, static_cast<double>(M) / L));
+        return (static_cast<size_t>(perPhase) + LANES - 1) / LANES * LANES;
+    }
+
+    static float dot(const float* a, const float* b, size_t n) {
+        float acc[LANES] = {};
+        for(size_t i = 0; i < n; i += LANES)
+            for(size_t j = 0; j < LANES; j++)
+                acc[j] += a[i + j] * b[i + j];
+        float sum = 0.0f;
+        for(size_t j = 0; j < LANES; j++)
+            sum += acc[j];
+        return sum;
+    }
+
+    // Outputs whose input index is in the current block, at most "limit" in total
+    size_t produce(size_t frames, float* out, uint64_t limit) {
+        size_t n = 0;
+        while(produced < limit) {
+            uint64_t t = produced * M + D;
+            uint64_t i = t / L;
+            if(i >= consumed + frames)
+                break;
+            const float* h = &bank[(t % L) * Np];
+            size_t start = static_cast<size_t>(i - consumed); // x[i - Np + 1] in the buffer
+            for(int c = 0; c < channels; c++)
+                out[n * channels + c] = dot(h, &history[c][start], Np);
+            produced++;
+            n++;
+        }
+        return n;
+    }
+
+    size_t feed(const float* in, size_t frames, float* out, uint64_t limit) {
+        for(int c = 0; c < channels; c++) {
+            AlignedBuffer<float>& buf = history[c];
+            buf.resize(Np - 1 + frames); // keeps the history
+            for(size_t f = 0; f < frames; f++)
+                buf[Np - 1 + f] = in ? in[f * channels + c] : 0.0f;
+        }
+        size_t n = produce(frames, out, limit);
+        for(int c = 0; c < channels; c++) {
+            AlignedBuffer<float>& buf = history[c];
+            std::copy(buf.data() + frames, buf.data() + frames + Np - 1, buf.data());
+        }
+        consumed += frames;
+        return n;
+    }
+
+  public:
+    // taps: per phase when upsampling; scaled by M / L when downsampling, so
+    // the transition band stays as narrow relative to the output rate
+    PolyphaseResampler(int inRate, int outRate, int channels, size_t taps = 64)
+        : channels(channels), history(channels) {
+        ratio(inRate, outRate, L, M);
+        Np = phase_taps(L, M, taps);
+        // Odd length (the last coefficient of the bank stays 0), so the delay
+        // is a whole number of upsampled samples
+        const size_t length = L * Np - 1;
+        D = (length - 1) / 2;
+
+        // Transition band of a Kaiser filter of this length, in cycles per input
+        // sample, ending at the Nyquist frequency of the lower rate
+        const double lowRate = std::min(1.0, static_cast<double>(L) / M); // in input samples
+        const double width = (ATTENUATION - 8.0) / (14.36 * Np);
+        const double fc = (0.5 * lowRate - width / 2.0) / L; // cycles per upsampled sample
+        const double beta = 0.1102 * (ATTENUATION - 8.7);
+        const double center = static_cast<double>(D);
+
+        bank.resize(L * Np);
+        bank[(L - 1) * Np] = 0.0f; // tap j = length (phase L - 1, reversed)
+        for(size_t j = 0; j < length; j++) {
+            double x = j - center;
+            double s = x == 0.0 ? 1.0 : std::sin(2.0 * M_PI * fc * x) / (2.0 * M_PI * fc * x);
+            double r = x / center;
+            double w = bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / bessel_i0(beta);
+            double h = L * 2.0 * fc * s * w; // gain L: the upsampling keeps 1 sample in L
+            size_t p = j % L, k = j / L;
+            bank[p * Np + (Np - 1 - k)] = static_cast<float>(h);
+        }
+
+        for(auto& buf : history) {
+            buf.resize(Np - 1);
+            std::fill(buf.begin(), buf.end(), 0.0f); // silence before the stream
+        }
+    }
+
+    // Coefficients of the filter bank of a converter with these parameters
+    // (L * Np, saturated), without building it: check before constructing
+    static uint64_t bank_size(int inRate, int outRate, size_t taps = 64) {
+        uint64_t l, m;
+        ratio(inRate, outRate, l, m);
+        uint64_t np = phase_taps(l, m, taps);
+        return np > UINT64_MAX / l ? UINT64_MAX : l * np;
+    }
+
+    uint64_t up() const { return L; }
+    uint64_t down() const { return M; }
+    size_t taps_per_phase() const { return Np; }
+
+    // Upper bound of the output frames of a block of "frames" input frames
+    // (also of flush(), with frames = taps_per_phase())
+    size_t max_output(size_t frames) const {
+        return static_cast<size_t>(static_cast<uint64_t>(frames) * L / M) + 2;
+    }
+
+    // Returns the number of output frames written to out
+    size_t process(const float* in, size_t frames, float* out) {
+        return feed(in, frames, out, UINT64_MAX);
+    }
+
+    // End of the input: the remaining output frames (the filter is fed silence)
+    size_t flush(float* out) {
+        if(flushed)
+            return 0;
+        flushed = true;
+        uint64_t total = (consumed * L + M - 1) / M;
+        return feed(nullptr, Np, out, total);
+    }
+};
+
+#endif
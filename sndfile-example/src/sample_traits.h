@@ -0,0 +1,95 @@
+#ifndef SAMPLETRAITS_H
+#define SAMPLETRAITS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <sndfile.h>
+
+//------------------------------------------------------------------------------
+// Sample types the kernels are instantiated for, as libsndfile reads each
+// format natively: PCM_16 as short, PCM_24 and PCM_32 as int (left-justified,
+// i.e. a 24-bit sample x reads as x * 256) and FLOAT as float (full scale is
+// +-1.0, not clipped)
+//------------------------------------------------------------------------------
+template <typename T>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<short> {
+    using Wide = int; // holds the sum or difference of two samples
+    static constexpr bool IS_INTEGER = true;
+    static constexpr int BITS = 16;
+    static constexpr double MIN = -32768.0;
+    static constexpr double MAX = 32767.0;
+};
+
+template <>
+struct SampleTraits<int> {
+    using Wide = int64_t;
+    static constexpr bool IS_INTEGER = true;
+    static constexpr int BITS = 32;
+    static constexpr double MIN = -2147483648.0;
+    static constexpr double MAX = 2147483647.0;
+};
+
+template <>
+struct SampleTraits<float> {
+    using Wide = double;
+    static constexpr bool IS_INTEGER = false;
+    static constexpr int BITS = 24; // precision of the mantissa
+};
+
+// A computed value as a sample: integers are rounded half away from zero and
+// saturated, floats are stored as they are
+template <typename T>
+inline T to_sample(double v) {
+    if constexpr (SampleTraits<T>::IS_INTEGER) {
+        v += v >= 0.0 ? 0.5 : -0.5;
+        v = v > SampleTraits<T>::MAX ? SampleTraits<T>::MAX : v;
+        v = v < SampleTraits<T>::MIN ? SampleTraits<T>::MIN : v;
+        return static_cast<T>(v);
+    } else {
+        return static_cast<T>(v);
+    }
+}
+
+// Bits per sample of a subformat (FLOAT: the precision of its mantissa), or 0
+// if the tools do not support it
+inline int sample_bits(int format) {
+    switch(format & SF_FORMAT_SUBMASK) {
+        case SF_FORMAT_PCM_16: return 16;
+        case SF_FORMAT_PCM_24: return 24;
+        case SF_FORMAT_PCM_32: return 32;
+        case SF_FORMAT_FLOAT:  return 24;
+        default:               return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Float processing (wav_effects, wav_resample) in 16-bit units (full scale is
+// +-32768) whatever the native type: samples are converted once when read and
+// converted back once when written, integers rounded and saturated
+//------------------------------------------------------------------------------
+template <typename T>
+constexpr double float_units_per_sample() {
+    if constexpr (SampleTraits<T>::IS_INTEGER)
+        return 32768.0 / (SampleTraits<T>::MAX + 1.0);
+    else
+        return 32768.0;
+}
+
+template <typename T>
+inline void samples_to_float(const T* in, float* out, size_t n) {
+    constexpr float scale = static_cast<float>(float_units_per_sample<T>());
+    for(size_t i = 0; i < n; i++)
+        out[i] = static_cast<float>(in[i]) * scale;
+}
+
+template <typename T>
+inline void float_to_samples(const float* in, T* out, size_t n) {
+    constexpr double scale = 1.0 / float_units_per_sample<T>();
+    for(size_t i = 0; i < n; i++)
+        out[i] = to_sample<T>(in[i] * scale);
+}
+
+#endif
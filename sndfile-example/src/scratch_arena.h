@@ -0,0 +1,139 @@
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+//------------------------------------------------------------------------------
+// Scratch arena: the temporary arrays of one thread (DCT buffers, float
+// working copies, pointer tables...), handed out by bumping an offset. Every
+// array is 64-byte aligned: a cache line, any SIMD width, and at least the
+// alignment FFTW gives its own arrays, so a plan made on one arena array can
+// run on any other (fftw_execute_r2r and friends).
+//
+// A Scope gives back everything taken since it was opened, so a loop that
+// opens a Scope per block allocates nothing once the arena has grown to the
+// size of one block. A request that does not fit chains a new chunk; when the
+// arena is empty again its chunks are replaced by a single one as large as
+// the high-water mark.
+//
+//   ScratchArena arena;                  // one per thread, kept across files
+//   for(each block) {
+//       ScratchArena::Scope scope(arena);
+//       double* x = arena.alloc<double>(n);
+//       ...
+//   }
+//------------------------------------------------------------------------------
+class ScratchArena {
+  private:
+    static constexpr size_t ALIGNMENT = 64;
+    static constexpr size_t MIN_CHUNK = 64 * 1024;
+
+    struct Chunk {
+        std::byte* base;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current = 0;   // chunk being filled
+    size_t offset = 0;    // bytes used in it
+    size_t used = 0;      // bytes handed out, over all chunks
+    size_t highWater = 0;
+    size_t nMallocs = 0;
+
+    static size_t round_up(size_t bytes) {
+        return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    void add_chunk(size_t bytes) {
+        size_t size = std::max(bytes, chunks.empty() ? MIN_CHUNK : 2 * chunks.back().size);
+        std::byte* p = static_cast<std::byte*>(std::aligned_alloc(ALIGNMENT, size));
+        if(!p)
+            throw std::bad_alloc();
+        nMallocs++;
+        chunks.push_back({ p, size });
+        current = chunks.size() - 1;
+        offset = 0;
+    }
+
+  public:
+    struct Mark {
+        size_t chunk;
+        size_t offset;
+        size_t used;
+    };
+
+    class Scope {
+      private:
+        ScratchArena& arena;
+        Mark m;
+
+      public:
+        explicit Scope(ScratchArena& arena) : arena(arena), m(arena.mark()) {}
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope() { arena.release(m); }
+    };
+
+    ScratchArena() = default;
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    ~ScratchArena() {
+        for(Chunk& c : chunks)
+            std::free(c.base);
+    }
+
+    // n uninitialized elements, valid until the enclosing Scope ends
+    template <typename T>
+    T* alloc(size_t n) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena arrays are never destroyed");
+        static_assert(alignof(T) <= ALIGNMENT);
+        size_t bytes = round_up(std::max<size_t>(n, 1) * sizeof(T));
+        if(chunks.empty() || offset + bytes > chunks[current].size)
+            add_chunk(bytes);
+        T* p = reinterpret_cast<T*>(chunks[current].base + offset);
+        offset += bytes;
+        used += bytes;
+        highWater = std::max(highWater, used);
+        return p;
+    }
+
+    Mark mark() const {
+        return { current, offset, used };
+    }
+
+    void release(const Mark& m) {
+        while(chunks.size() > m.chunk + 1) {
+            std::free(chunks.back().base);
+            chunks.pop_back();
+        }
+        current = m.chunk;
+        offset = m.offset;
+        used = m.used;
+        if(used == 0 && !chunks.empty() && chunks[0].size < highWater) {
+            std::free(chunks[0].base);
+            chunks.clear();
+            add_chunk(round_up(highWater));
+        }
+    }
+
+    // Most bytes in use at any time
+    size_t high_water() const { return highWater; }
+
+    size_t capacity() const {
+        size_t total = 0;
+        for(const Chunk& c : chunks)
+            total += c.size;
+        return total;
+    }
+
+    // Chunks allocated so far (steady state: no more)
+    size_t mallocs() const { return nMallocs; }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+#include <string>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+// Hot-path instrumentation ("--stats json"): time spent in and number of calls
+// of each stage, plus the amount of data read and produced. A tool keeps one
+// Stats per thread and passes nullptr where stats were not asked for. Built
+// without AUDIO_STATS (CMake option of the same name), the timers and counters
+// are empty inline functions and compile out.
+//------------------------------------------------------------------------------
+enum class Stage { Read, Deinterleave, Convert, Transform, Quantize, BitPack, Flush, Write };
+
+constexpr size_t N_STAGES = 8;
+
+inline const char* stage_name(size_t stage) {
+    static const char* const names[N_STAGES] = {
+        "read", "deinterleave", "convert", "transform", "quantize", "bitpack", "flush", "write"
+    };
+    return names[stage];
+}
+
+#ifdef AUDIO_STATS
+constexpr bool STATS_ENABLED = true;
+#else
+constexpr bool STATS_ENABLED = false;
+#endif
+
+struct Stats {
+    uint64_t ns[N_STAGES] = {};
+    uint64_t calls[N_STAGES] = {};
+    uint64_t files = 0;
+    uint64_t frames = 0;
+    uint64_t bytesIn = 0;  // decoded sample bytes
+    uint64_t bytesOut = 0; // encoded or written bytes
+    uint64_t bitsOut = 0;  // payload bits (encoders)
+    uint64_t scratchBytes = 0; // high-water mark of the thread's scratch arena
+
+    void add(const Stats& other) {
+        for(size_t s = 0; s < N_STAGES; s++) {
+            ns[s] += other.ns[s];
+            calls[s] += other.calls[s];
+        }
+        files += other.files;
+        frames += other.frames;
+        bytesIn += other.bytesIn;
+        bytesOut += other.bytesOut;
+        bitsOut += other.bitsOut;
+        scratchBytes += other.scratchBytes; // the arenas of all threads
+    }
+
+    // One JSON object; stage times are summed over all threads
+    void write_json(std::ostream& os, const std::string& tool, unsigned threads, double wallSeconds) const {
+        os << "{\"tool\": \"" << tool << "\", \"enabled\": " << (STATS_ENABLED ? "true" : "false")
+           << ", \"threads\": " << threads << ", \"files\": " << files
+           << std::fixed << std::setprecision(6) << ", \"wall_s\": " << wallSeconds
+           << ", \"frames\": " << frames << ", \"bytes_in\": " << bytesIn
+           << ", \"bytes_out\": " << bytesOut << ", \"bits_out\": " << bitsOut
+           << ", \"scratch_bytes\": " << scratchBytes << ", \"stages\": {";
+        for(size_t s = 0; s < N_STAGES; s++)
+            os << (s ? ", " : "") << '"' << stage_name(s) << "\": {\"calls\": " << calls[s]
+               << ", \"seconds\": " << ns[s] * 1e-9 << '}';
+        os << "}}\n";
+        os.unsetf(std::ios::floatfield);
+        os << std::setprecision(6);
+    }
+};
+
+#ifdef AUDIO_STATS
+
+// Adds the lifetime of the object to one stage
+class StageTimer {
+  private:
+    Stats* stats;
+    size_t stage;
+    std::chrono::steady_clock::time_point t0;
+
+  public:
+    StageTimer(Stats* stats, Stage stage) : stats(stats), stage(static_cast<size_t>(stage)) {
+        if(stats)
+            t0 = std::chrono::steady_clock::now();
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        if(stats) {
+            auto t = std::chrono::steady_clock::now() - t0;
+            stats->ns[stage] += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t).count());
+            stats->calls[stage]++;
+        }
+    }
+};
+
+// e.g. stats_count(stats, &Stats::frames, n)
+inline void stats_count(Stats* stats, uint64_t Stats::* counter, uint64_t n) {
+    if(stats)
+        stats->*counter += n;
+}
+
+inline void stats_set_max(Stats* stats, uint64_t Stats::* counter, uint64_t n) {
+    if(stats)
+        stats->*counter = std::max(stats->*counter, n);
+}
+
+#else
+
+class StageTimer {
+  public:
+    StageTimer(Stats*, Stage) {}
+};
+
+inline void stats_count(Stats*, uint64_t Stats::*, uint64_t) {}
+inline void stats_set_max(Stats*, uint64_t Stats::*, uint64_t) {}
+
+#endif
+
+// Runs f() (e.g. a read in a loop condition) as one call of a stage
+template <typename F>
+inline auto timed(Stats* stats, Stage stage, F&& f) {
+    StageTimer t(stats, stage);
+    return f();
+}
+
+// "--stats json" (the only format); returns false for anything else
+inline bool parse_stats_format(const std::string& arg) {
+    return arg == "json";
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef STFT_H
+#define STFT_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <mutex>
+#include <algorithm>
+#include <fftw3.h>
+#include "thread_pool.h"
+#include "scratch_arena.h"
+
+enum class Window { Hann, Hamming, Rect };
+
+inline bool parse_window(const std::string& name, Window& w) {
+    if(name == "hann")
+        w = Window::Hann;
+    else if(name == "hamming")
+        w = Window::Hamming;
+    else if(name == "rect")
+        w = Window::Rect;
+    else
+        return false;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Short-time Fourier transform magnitudes of a mono signal (full scale = 1):
+// frames of n samples, "hop" samples apart, windowed and transformed into the
+// n / 2 + 1 bins of a real DFT. One FFTW plan does CHUNK frames per call
+// (fftw_plan_many_dft_r2c, rows n samples apart); the chunks of a block are
+// tasks of the thread pool, each working in the scratch arena of its worker
+// (fftw_execute_dft_r2c on arena arrays, see scratch_arena.h).
+//
+// Magnitudes are scaled so a sinusoid of amplitude a that falls on a bin
+// reads a, whatever the window; in dB (dBFS) they are floored at -200 dB.
+//------------------------------------------------------------------------------
+class STFT {
+  public:
+    static constexpr size_t CHUNK = 32; // frames per FFTW call and per task
+
+  private:
+    static constexpr double MIN_MAGNITUDE = 1e-10;
+
+    size_t n, hop, nBins;
+    bool dB;
+    std::vector<double> window;
+    std::vector<double> scale; // per bin
+    fftw_plan plan = nullptr;
+
+  public:
+    STFT(size_t n, size_t hop, Window w, bool dB) : n(n), hop(hop), nBins(n / 2 + 1), dB(dB), window(n), scale(nBins) {
+        // Periodic (DFT-even) windows
+        double sum = 0.0;
+        for(size_t i = 0; i < n; i++) {
+            double phase = 2.0 * M_PI * i / n;
+            window[i] = w == Window::Hann ? 0.5 - 0.5 * std::cos(phase)
+                      : w == Window::Hamming ? 0.54 - 0.46 * std::cos(phase)
+                      : 1.0;
+            sum += window[i];
+        }
+        for(size_t k = 0; k < nBins; k++)
+            scale[k] = (k == 0 || 2 * k == n ? 1.0 : 2.0) / sum;
+
+        // Planned on FFTW's own arrays; with FFTW_ESTIMATE they are not touched
+        const int size = static_cast<int>(n);
+        double* x = fftw_alloc_real(CHUNK * n);
+        fftw_complex* X = fftw_alloc_complex(CHUNK * nBins);
+        {
+            std::lock_guard<std::mutex> lk(fftw_planner_mutex());
+            plan = fftw_plan_many_dft_r2c(1, &size, static_cast<int>(CHUNK), x, nullptr, 1, size, X, nullptr, 1,
+                                          static_cast<int>(nBins), FFTW_ESTIMATE);
+        }
+        fftw_free(x);
+        fftw_free(X);
+    }
+
+    STFT(const STFT&) = delete;
+    STFT& operator=(const STFT&) = delete;
+
+    ~STFT() {
+        std::lock_guard<std::mutex> lk(fftw_planner_mutex());
+        fftw_destroy_plan(plan);
+    }
+
+    size_t bins() const { return nBins; }
+
+    // Frames that fit in "samples" samples
+    size_t frames(size_t samples) const {
+        return samples < n ? 0 : (samples - n) / hop + 1;
+    }
+
+    // Magnitudes of frames 0..nFrames-1 (frame f starts at signal[f * hop]),
+    // nFrames rows of bins() floats. "arenas": one per worker of the pool
+    void analyze(const double* signal, size_t nFrames, float* mags, ThreadPool& pool,
+                 std::vector<ScratchArena>& arenas) const {
+        for(size_t first = 0; first < nFrames; first += CHUNK)
+            pool.submit([=, this, &arenas](unsigned worker) {
+                ScratchArena& arena = arenas[worker];
+                ScratchArena::Scope scope(arena);
+                double* x = arena.alloc<double>(CHUNK * n);
+                fftw_complex* X = arena.alloc<fftw_complex>(CHUNK * nBins);
+
+                const size_t m = std::min(CHUNK, nFrames - first);
+                for(size_t f = 0; f < m; f++) {
+                    const double* s = signal + (first + f) * hop;
+                    for(size_t i = 0; i < n; i++)
+                        x[f * n + i] = s[i] * window[i];
+                }
+                std::fill(x + m * n, x + CHUNK * n, 0.0); // last chunk
+
+                fftw_execute_dft_r2c(plan, x, X);
+
+                for(size_t f = 0; f < m; f++) {
+                    const fftw_complex* row = X + f * nBins;
+                    float* out = mags + (first + f) * nBins;
+                    for(size_t k = 0; k < nBins; k++) {
+                        double mag = std::sqrt(row[k][0] * row[k][0] + row[k][1] * row[k][1]) * scale[k];
+                        out[k] = static_cast<float>(dB ? 20.0 * std::log10(std::max(mag, MIN_MAGNITUDE)) : mag);
+                    }
+                }
+            });
+        pool.wait();
+    }
+};
+
+#endif
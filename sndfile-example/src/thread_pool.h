@@ -0,0 +1,147 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+//------------------------------------------------------------------------------
+// Work-stealing thread pool. Every worker has its own task queue: it runs its
+// own tasks first (oldest first) and, when it has none left, takes the newest
+// task of another worker, so long jobs do not leave the other cores idle.
+// Tasks get the index of the worker running them (0..size()-1), which lets the
+// caller keep per-thread buffers and FFTW plans across tasks.
+//------------------------------------------------------------------------------
+class ThreadPool {
+  public:
+    using Task = std::function<void(unsigned worker)>;
+
+  private:
+    struct Queue {
+        std::mutex m;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> nextQueue { 0 };
+
+    std::mutex sleepMutex;               // guards queued and stop for waiting
+    std::condition_variable sleepCv;
+    size_t queued = 0;                   // tasks waiting in the queues
+    bool stop = false;
+
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+    size_t unfinished = 0;               // submitted and not yet finished
+
+    bool pop(unsigned id, Task& task) {
+        Queue& q = *queues[id];
+        std::lock_guard<std::mutex> lk(q.m);
+        if(q.tasks.empty())
+            return false;
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(unsigned id, Task& task) {
+        for(size_t i = 1; i < queues.size(); i++) {
+            Queue& q = *queues[(id + i) % queues.size()];
+            std::lock_guard<std::mutex> lk(q.m);
+            if(!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(unsigned id) {
+        for(;;) {
+            Task task;
+            if(pop(id, task) || steal(id, task)) {
+                {
+                    std::lock_guard<std::mutex> lk(sleepMutex);
+                    queued--;
+                }
+                task(id);
+                std::lock_guard<std::mutex> lk(doneMutex);
+                if(--unfinished == 0)
+                    doneCv.notify_all();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleepMutex);
+            sleepCv.wait(lk, [this] { return stop || queued > 0; });
+            if(stop && queued == 0)
+                return;
+        }
+    }
+
+  public:
+    explicit ThreadPool(unsigned nThreads = std::thread::hardware_concurrency()) {
+        nThreads = nThreads > 0 ? nThreads : 1;
+        for(unsigned t = 0; t < nThreads; t++)
+            queues.push_back(std::make_unique<Queue>());
+        for(unsigned t = 0; t < nThreads; t++)
+            workers.emplace_back(&ThreadPool::run, this, t);
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(sleepMutex);
+            stop = true;
+        }
+        sleepCv.notify_all();
+        for(auto& w : workers)
+            w.join();
+    }
+
+    unsigned size() const {
+        return static_cast<unsigned>(workers.size());
+    }
+
+    // Tasks are dealt round-robin over the worker queues
+    void submit(Task task) {
+        {
+            std::lock_guard<std::mutex> lk(doneMutex);
+            unfinished++;
+        }
+        {
+            std::lock_guard<std::mutex> lk(sleepMutex);
+            queued++; // counted before it is visible, so queued never goes below 0
+        }
+        Queue& q = *queues[nextQueue++ % queues.size()];
+        {
+            std::lock_guard<std::mutex> lk(q.m);
+            q.tasks.push_back(std::move(task));
+        }
+        sleepCv.notify_one();
+    }
+
+    // Blocks until every task submitted so far has finished
+    void wait() {
+        std::unique_lock<std::mutex> lk(doneMutex);
+        doneCv.wait(lk, [this] { return unfinished == 0; });
+    }
+};
+
+//------------------------------------------------------------------------------
+// FFTW plan creation and destruction are not thread safe (fftw_execute is);
+// code that plans while other threads may be planning holds this lock
+//------------------------------------------------------------------------------
+inline std::mutex& fftw_planner_mutex() {
+    static std::mutex m;
+    return m;
+}
+
+#endif
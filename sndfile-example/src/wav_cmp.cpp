@@ -1,83 +1,174 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <cstdio>
+#include <cstdint>
 #include <string>
+#include <thread>
+#include <algorithm>
+#include <fstream>
 #include <sndfile.hh>
+#include "audio_io.h"
+#include "wav_cmp.h"
 
 using namespace std;
 
 constexpr size_t FRAMES_BUFFER_SIZE = 65536;
+constexpr double SEG_SNR_MIN = -10.0; // per-window SNR clamping for segmental SNR (dB)
+constexpr double SEG_SNR_MAX = 35.0;
 
-struct Metrics{
-    long long count_samples = 0;
-    long double sum_sq_error = 0.0L;
-    long double sum_sq_signal = 0.0L;
-    int max_abs_error = 0;
-};
-
-static void accumulate_metrics(const short *orig, const short *test, size_t frames, int channels, vector<Metrics> &per_ch, Metrics &mid_metrics) {
-    for(size_t f = 0; f < frames; ++f){
-        int L = 0, R = 0;
-        bool have_stereo = (channels == 2);
+// Per-window metrics, computed in the same pass as the whole-file ones: each
+// window is accumulated on its own and then added to the totals, so only one
+// window of sums is kept. Rows are streamed as CSV; the per-window SNRs
+// (clamped to [SEG_SNR_MIN, SEG_SNR_MAX], silent windows skipped) are averaged
+// into the segmental SNR.
+template<typename T>
+struct WindowReport{
+    size_t window;          // frames per window
+    int channels;
+    double scale;
+    ostream *csv;           // may be null
+    vector<Metrics<T>> win_ch;
+    Metrics<T> win_mid;
+    size_t filled = 0;
+    long long index = 0;
+    sf_count_t start = 0;
+    vector<double> seg_sum; // per channel, then MID
+    vector<long long> seg_count;
 
-        for(int c = 0; c < channels; ++c){
-            int idx = static_cast<int>(f * channels + c);
-            int x = static_cast<int>(orig[idx]);
-            int y = static_cast<int>(test[idx]);
-            int e = y - x;
-            Metrics &m = per_ch[c];
-            m.count_samples++;
-            m.sum_sq_error += static_cast<long double>(e) * e;
-            m.sum_sq_signal += static_cast<long double>(x) * x;
-            int ae = std::abs(e);
-
-            if(ae > m.max_abs_error){
-                m.max_abs_error = ae;
+    WindowReport(size_t window, int channels, double scale, ostream *csv)
+        : window(window), channels(channels), scale(scale), csv(csv), win_ch(channels),
+          seg_sum(channels + 1), seg_count(channels + 1) {
+        if(csv){
+            *csv << "window,start_frame,frames";
+            for(int c = 0; c < channels; ++c){
+                *csv << ",ch" << c << "_mse,ch" << c << "_linf,ch" << c << "_snr_db";
+            }
+            if(channels == 2){
+                *csv << ",mid_mse,mid_linf,mid_snr_db";
             }
+            *csv << "\n";
+        }
+    }
 
-            if(have_stereo){
-                if(c == 0){
-                    L = x; 
-                }else if(c == 1){
-                    R = x;
-                }
+    void add(const T *orig, const T *test, size_t frames, vector<Metrics<T>> &per_ch, Metrics<T> &mid_metrics){
+        while(frames > 0){
+            size_t n = min(frames, window - filled);
+            accumulate_metrics(orig, test, n, channels, scale, win_ch, win_mid);
+            orig += n * channels;
+            test += n * channels;
+            frames -= n;
+            if((filled += n) == window){
+                flush(per_ch, mid_metrics);
             }
         }
+    }
+
+    void flush(vector<Metrics<T>> &per_ch, Metrics<T> &mid_metrics){
+        if(filled == 0){
+            return;
+        }
+        if(csv){
+            *csv << index << ',' << start << ',' << filled;
+        }
+        for(int c = 0; c < channels; ++c){
+            row(win_ch[c], c);
+            per_ch[c].add(win_ch[c]);
+            win_ch[c] = Metrics<T>();
+        }
+        if(channels == 2){
+            row(win_mid, channels);
+            mid_metrics.add(win_mid);
+            win_mid = Metrics<T>();
+        }
+        if(csv){
+            *csv << "\n";
+        }
+        index++;
+        start += filled;
+        filled = 0;
+    }
 
-        // MID metrics: average of channels (L+R)/2 for original and test
-        if (have_stereo){
-            int idxL = static_cast<int>(f * channels + 0);
-            int idxR = static_cast<int>(f * channels + 1);
-            int x_mid = (static_cast<int>(orig[idxL]) + static_cast<int>(orig[idxR])) / 2; // integer division
-            int y_mid = (static_cast<int>(test[idxL]) + static_cast<int>(test[idxR])) / 2; // integer division
-            int e_mid = y_mid - x_mid;
-            mid_metrics.count_samples++;
-            mid_metrics.sum_sq_error += static_cast<long double>(e_mid) * e_mid;
-            mid_metrics.sum_sq_signal += static_cast<long double>(x_mid) * x_mid;
-            int ae_mid = std::abs(e_mid);
-            
-            if(ae_mid > mid_metrics.max_abs_error){
-                mid_metrics.max_abs_error = ae_mid;
+    void row(const Metrics<T> &m, int slot){
+        long double snr = snr_db(m);
+        if(m.sum_sq_signal > 0){
+            seg_sum[slot] += clamp(static_cast<double>(snr), SEG_SNR_MIN, SEG_SNR_MAX);
+            seg_count[slot]++;
+        }
+        if(csv){
+            *csv << ',' << static_cast<double>(static_cast<long double>(m.sum_sq_error) / m.count_samples)
+                 << ',' << m.max_abs_error << ',';
+            if(isinf(static_cast<double>(snr))){
+                *csv << "inf";
+            }else{
+                *csv << static_cast<double>(snr);
             }
         }
     }
+
+    void print_segmental(int slot) const {
+        if(seg_count[slot] == 0){
+            cout << "  Segmental SNR: n/a (no non-silent windows)\n";
+        }else{
+            cout << "  Segmental SNR: " << seg_sum[slot] / seg_count[slot] << " dB (" << seg_count[slot] << " windows)\n";
+        }
+    }
+};
+
+// Compares frames [start, start+count) of both files using its own file handles,
+// so that several ranges can be processed concurrently
+template<typename T>
+static void compare_range(const string &origFile, const string &testFile, sf_count_t start, sf_count_t count, double scale,
+                          vector<Metrics<T>> &per_ch, Metrics<T> &mid_metrics, bool &ok, WindowReport<T> *report = nullptr) {
+    SndfileHandle sfOrig { origFile };
+    SndfileHandle sfTest { testFile };
+    ok = !sfOrig.error() && !sfTest.error() && sfOrig.seek(start, SEEK_SET) == start && sfTest.seek(start, SEEK_SET) == start;
+    if(!ok){
+        return;
+    }
+
+    const int channels = sfOrig.channels();
+    vector<T> bufOrig(FRAMES_BUFFER_SIZE * channels);
+    vector<T> bufTest(FRAMES_BUFFER_SIZE * channels);
+    sf_count_t frames_remaining = count;
+
+    while(frames_remaining > 0){
+        sf_count_t to_read = std::min<sf_count_t>(frames_remaining, FRAMES_BUFFER_SIZE);
+        sf_count_t r1 = sfOrig.readf(bufOrig.data(), to_read);
+        sf_count_t r2 = sfTest.readf(bufTest.data(), to_read);
+        sf_count_t r = std::min(r1, r2);
+        if (r <= 0) break;
+        if(report){
+            report->add(bufOrig.data(), bufTest.data(), static_cast<size_t>(r), per_ch, mid_metrics);
+        }else{
+            accumulate_metrics(bufOrig.data(), bufTest.data(), static_cast<size_t>(r), channels, scale, per_ch, mid_metrics);
+        }
+        frames_remaining -= r;
+    }
+    if(report){
+        report->flush(per_ch, mid_metrics); // last, partial window
+    }
 }
 
-static void print_metrics(const string &label, const Metrics &m) {
+template<typename T>
+static void print_metrics(const string &label, const Metrics<T> &m) {
     if(m.count_samples == 0){
         return;
     }
 
-    long double mse = m.sum_sq_error / static_cast<long double>(m.count_samples);
+    const long double sum_sq_error = static_cast<long double>(m.sum_sq_error);
+    const long double sum_sq_signal = static_cast<long double>(m.sum_sq_signal);
+    long double mse = sum_sq_error / static_cast<long double>(m.count_samples);
     long double snr_db;
 
-    if(m.sum_sq_signal <= 0.0L || mse <= 0.0L){
+    if(sum_sq_signal <= 0.0L || mse <= 0.0L){
         snr_db = INFINITY;
     }else{
-        long double snr = m.sum_sq_signal / m.sum_sq_error;
+        long double snr = sum_sq_signal / sum_sq_error;
         snr_db = 10.0L * log10(snr);
     }
-    
+
+
     cout << label << "\n";
     cout << "  L2 (MSE): " << static_cast<double>(mse) << "\n";
     cout << "  L_inf (max abs err): " << m.max_abs_error << "\n";
@@ -89,14 +180,119 @@ static void print_metrics(const string &label, const Metrics &m) {
     }
 }
 
+// Whole-file (or windowed, when window > 0) comparison, reading both files as T
+template<typename T>
+static int compare_files(const string &origFile, const string &testFile, int channels, sf_count_t total_frames,
+                         double scale, size_t window, ostream *csv, unsigned nThreads) {
+    if(window > 0){
+        // Windows are streamed in file order, so the comparison runs as a
+        // single sequential pass
+        WindowReport<T> report(window, channels, scale, csv);
+        vector<Metrics<T>> per_ch(channels);
+        Metrics<T> mid_metrics; // stereo only
+        bool ok;
+        compare_range(origFile, testFile, 0, total_frames, scale, per_ch, mid_metrics, ok, &report);
+        if(!ok){
+            cerr << "Error: cannot read input files\n";
+            return 1;
+        }
+        if(csv == &cout){
+            return 0; // stdout carries only the CSV stream
+        }
+
+        for(int c = 0; c < channels; ++c){
+            print_metrics("Channel " + to_string(c), per_ch[c]);
+            report.print_segmental(c);
+        }
+        if(channels == 2){
+            print_metrics("MID ( (L+R)/2 )", mid_metrics);
+            report.print_segmental(channels);
+        }
+        return 0;
+    }
+
+    // Split the files in one contiguous range per thread, then reduce; the
+    // integer sums make the result independent of the split (PCM_16 only)
+    if(total_frames < static_cast<sf_count_t>(FRAMES_BUFFER_SIZE)){
+        nThreads = 1;
+    }
+    nThreads = static_cast<unsigned>(std::min<sf_count_t>(nThreads, std::max<sf_count_t>(total_frames, 1)));
+
+    vector<vector<Metrics<T>>> part_ch(nThreads, vector<Metrics<T>>(channels));
+    vector<Metrics<T>> part_mid(nThreads); // stereo only
+    vector<char> part_ok(nThreads);
+    vector<thread> workers;
+    for(unsigned t = 0; t < nThreads; ++t){
+        sf_count_t start = total_frames * t / nThreads;
+        sf_count_t count = total_frames * (t + 1) / nThreads - start;
+        workers.emplace_back([&, t, start, count]{
+            bool ok;
+            compare_range(origFile, testFile, start, count, scale, part_ch[t], part_mid[t], ok);
+            part_ok[t] = ok;
+        });
+    }
+    for(auto &w : workers){
+        w.join();
+    }
+
+    vector<Metrics<T>> per_ch(channels);
+    Metrics<T> mid_metrics; // stereo only
+    for(unsigned t = 0; t < nThreads; ++t){
+        if(!part_ok[t]){
+            cerr << "Error: cannot read input files\n";
+            return 1;
+        }
+        for(int c = 0; c < channels; ++c){
+            per_ch[c].add(part_ch[t][c]);
+        }
+        mid_metrics.add(part_mid[t]);
+    }
+
+    // Print per-channel metrics
+    for(int c = 0; c < channels; ++c){
+        print_metrics("Channel " + to_string(c), per_ch[c]);
+    }
+
+    // Print MID metrics if stereo
+    if(channels == 2){
+        print_metrics("MID ( (L+R)/2 )", mid_metrics);
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     bool verbose { false };
+    unsigned nThreads = max(1u, thread::hardware_concurrency());
+    string windowArg;
+    string csvFile;
 
     if(argc < 3){
-        cerr << "Usage: wav_cmp [ -v ] wavFileOriginal wavFileTest\n";
+        cerr << "Usage: wav_cmp [ -v ] [ -j threads ] [ -w frames|<N>ms [ -csv file|- ] ] wavFileOriginal wavFileTest\n";
         return 1;
     }
 
+    for(int n = 1; n < argc - 2; ++n){
+        if(string(argv[n]) == "-j"){
+            nThreads = static_cast<unsigned>(max(1, atoi(argv[n+1])));
+            break;
+        }
+    }
+
+    for(int n = 1; n < argc - 2; ++n){
+        if(string(argv[n]) == "-w"){
+            windowArg = argv[n+1];
+            break;
+        }
+    }
+
+    for(int n = 1; n < argc - 2; ++n){
+        if(string(argv[n]) == "-csv"){
+            csvFile = argv[n+1];
+            break;
+        }
+    }
+
     for(int n = 1; n < argc; ++n){
         if(string(argv[n]) == "-v"){ 
             verbose = true; 
@@ -116,20 +312,8 @@ int main(int argc, char *argv[]) {
         return 1; 
     }
 
-    auto check_wav16 = [](const SndfileHandle &sf) -> bool {
-        if((sf.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV){
-            return false;
-        }
-
-        if ((sf.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16){
-            return false;
-        }
-
-        return true;
-    };
-
-    if(!check_wav16(sfOrig) || !check_wav16(sfTest)){
-        cerr << "Error: both files must be WAV PCM_16\n";
+    if(!check_wav(sfOrig).empty() || !check_wav(sfTest).empty()){
+        cerr << "Error: both files must be WAV PCM_16, PCM_24, PCM_32 or FLOAT\n";
         return 1;
     }
 
@@ -149,31 +333,37 @@ int main(int argc, char *argv[]) {
         cout << "Comparing up to " << total_frames << " frames, " << channels << " channels, " << sfOrig.samplerate() << " Hz\n";
     }
 
-    vector<Metrics> per_ch(channels);
-    Metrics mid_metrics; // stereo only
-    vector<short> bufOrig(FRAMES_BUFFER_SIZE * channels);
-    vector<short> bufTest(FRAMES_BUFFER_SIZE * channels);
-    sf_count_t frames_remaining = total_frames;
-    
-    while(frames_remaining > 0){
-        sf_count_t to_read = std::min<sf_count_t>(frames_remaining, FRAMES_BUFFER_SIZE);
-        sf_count_t r1 = sfOrig.readf(bufOrig.data(), to_read);
-        sf_count_t r2 = sfTest.readf(bufTest.data(), to_read);
-        sf_count_t r = std::min(r1, r2);
-        if (r <= 0) break;
-        accumulate_metrics(bufOrig.data(), bufTest.data(), static_cast<size_t>(r), channels, per_ch, mid_metrics);
-        frames_remaining -= r;
-    }
-
-    // Print per-channel metrics
-    for(int c = 0; c < channels; ++c){
-        print_metrics("Channel " + to_string(c), per_ch[c]);
+    // Windowed report: window given in frames, or in milliseconds with an "ms" suffix
+    size_t window = 0;
+    if(!windowArg.empty()){
+        double w = atof(windowArg.c_str());
+        if(windowArg.size() > 2 && windowArg.substr(windowArg.size() - 2) == "ms"){
+            w = w * sfOrig.samplerate() / 1000.0;
+        }
+        window = static_cast<size_t>(llround(w));
+        if(window == 0){
+            cerr << "Error: invalid window size\n";
+            return 1;
+        }
     }
 
-    // Print MID metrics if stereo
-    if(channels == 2){
-        print_metrics("MID ( (L+R)/2 )", mid_metrics);
+    ofstream csvOut;
+    if(!csvFile.empty() && csvFile != "-"){
+        csvOut.open(csvFile);
+        if(!csvOut){
+            cerr << "Error: cannot open CSV output file\n";
+            return 1;
+        }
     }
 
-    return 0;
-}
\ No newline at end of file
+    // Both files are read as the wider of their sample types (libsndfile
+    // converts between formats); ints are compared in LSBs of the file with
+    // more bits
+    const SampleType type = max(sample_type(sfOrig), sample_type(sfTest));
+    const int bits = max(sample_bits(sfOrig.format()), sample_bits(sfTest.format()));
+    const double scale = type == SampleType::Int ? ldexp(1.0, bits - 32) : 1.0;
+    ostream *csv = csvFile.empty() ? nullptr : csvFile == "-" ? static_cast<ostream*>(&cout) : &csvOut;
+    return with_sample_type(type, [&](auto zero){
+        return compare_files<decltype(zero)>(argv[argc-2], argv[argc-1], channels, total_frames, scale, window, csv, nThreads);
+    });
+}
@@ -0,0 +1,161 @@
+#ifndef WAVCMP_H
+#define WAVCMP_H
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+//------------------------------------------------------------------------------
+// Error metrics of a test signal against the original (wav_cmp), accumulated
+// block by block over interleaved samples
+//------------------------------------------------------------------------------
+constexpr size_t LANES = 16; // samples per step of the vectorized kernels
+
+// Arithmetic per sample type. PCM_16 sums are kept as exact integers
+// (|e| <= 65535, so e*e fits in 32 bits and 2^32 samples fit in 64 bits); they
+// are only turned into floating point when printed. Other formats are
+// compared in double, in LSBs of the finer file (FLOAT: full scale is 1).
+template<typename T>
+struct CmpTypes{
+    using Value = double;
+    using Square = double;
+    using Sum = double;
+};
+
+template<>
+struct CmpTypes<short>{
+    using Value = int;
+    using Square = uint32_t;
+    using Sum = uint64_t;
+};
+
+template<typename T>
+inline typename CmpTypes<T>::Value to_value(T s, double scale){
+    if constexpr (std::is_same_v<T, short>){
+        (void)scale;
+        return s;
+    }else{
+        return s * scale;
+    }
+}
+
+template<typename T>
+struct Metrics{
+    using Value = typename CmpTypes<T>::Value;
+    using Sum = typename CmpTypes<T>::Sum;
+
+    long long count_samples = 0;
+    Sum sum_sq_error = 0;
+    Sum sum_sq_signal = 0;
+    Value max_abs_error = 0;
+
+    void add(const Metrics &m){
+        count_samples += m.count_samples;
+        sum_sq_error += m.sum_sq_error;
+        sum_sq_signal += m.sum_sq_signal;
+        max_abs_error = std::max(max_abs_error, m.max_abs_error);
+    }
+};
+
+// Per-lane accumulators; lane j of a run of interleaved samples belongs to
+// channel j % channels whenever LANES is a multiple of the channel count
+template<typename T>
+struct LaneSums{
+    typename CmpTypes<T>::Sum sq_error[LANES] = {};
+    typename CmpTypes<T>::Sum sq_signal[LANES] = {};
+    typename CmpTypes<T>::Value max_abs_error[LANES] = {};
+
+    void fold(Metrics<T> *m, size_t stride, long long samples_per_lane){
+        for(size_t j = 0; j < LANES; ++j){
+            Metrics<T> &d = m[j % stride];
+            d.count_samples += samples_per_lane;
+            d.sum_sq_error += sq_error[j];
+            d.sum_sq_signal += sq_signal[j];
+            d.max_abs_error = std::max(d.max_abs_error, max_abs_error[j]);
+        }
+    }
+};
+
+template<typename T>
+inline void accumulate_sample(typename CmpTypes<T>::Value x, typename CmpTypes<T>::Value y, Metrics<T> &m){
+    using Square = typename CmpTypes<T>::Square;
+    auto e = y - x;
+    auto ae = e < 0 ? -e : e;
+    m.count_samples++;
+    m.sum_sq_error += static_cast<Square>(ae) * static_cast<Square>(ae);
+    m.sum_sq_signal += static_cast<Square>(x) * static_cast<Square>(x);
+    m.max_abs_error = std::max(m.max_abs_error, ae);
+}
+
+// Branch-free loop over LANES consecutive values of a and b, written so that
+// the compiler turns it into SIMD code
+template<typename T, typename Load>
+inline void accumulate_lanes(LaneSums<T> &acc, Load load, size_t i){
+    using Value = typename CmpTypes<T>::Value;
+    using Square = typename CmpTypes<T>::Square;
+    for(size_t j = 0; j < LANES; ++j){
+        Value x, y;
+        load(i + j, x, y);
+        Value e = y - x;
+        Value ae = e < 0 ? -e : e;
+        acc.sq_error[j] += static_cast<Square>(ae) * static_cast<Square>(ae);
+        acc.sq_signal[j] += static_cast<Square>(x) * static_cast<Square>(x);
+        acc.max_abs_error[j] = std::max(acc.max_abs_error[j], ae);
+    }
+}
+
+// scale: LSB of the comparison, in units of the int samples (see CmpTypes)
+template<typename T>
+inline void accumulate_metrics(const T *orig, const T *test, size_t frames, int channels, double scale,
+                               std::vector<Metrics<T>> &per_ch, Metrics<T> &mid_metrics) {
+    using Value = typename CmpTypes<T>::Value;
+    const size_t n = frames * channels;
+    size_t i = 0;
+
+    // Per-channel metrics, straight over the interleaved buffer
+    if(LANES % channels == 0){
+        LaneSums<T> acc;
+        auto load = [&](size_t k, Value &x, Value &y){ x = to_value(orig[k], scale); y = to_value(test[k], scale); };
+        for(; i + LANES <= n; i += LANES){
+            accumulate_lanes(acc, load, i);
+        }
+        acc.fold(per_ch.data(), channels, static_cast<long long>(i / LANES));
+    }
+    for(; i < n; ++i){
+        accumulate_sample(to_value(orig[i], scale), to_value(test[i], scale), per_ch[i % channels]);
+    }
+
+    // MID metrics: average of channels (L+R)/2 for original and test
+    if(channels == 2){
+        size_t f = 0;
+        LaneSums<T> acc;
+        auto load = [&](size_t k, Value &x, Value &y){
+            x = (to_value(orig[2*k], scale) + to_value(orig[2*k+1], scale)) / 2; // integer division for PCM_16
+            y = (to_value(test[2*k], scale) + to_value(test[2*k+1], scale)) / 2;
+        };
+        for(; f + LANES <= frames; f += LANES){
+            accumulate_lanes(acc, load, f);
+        }
+        acc.fold(&mid_metrics, 1, static_cast<long long>(f / LANES));
+        for(; f < frames; ++f){
+            Value x_mid, y_mid;
+            load(f, x_mid, y_mid);
+            accumulate_sample(x_mid, y_mid, mid_metrics);
+        }
+    }
+}
+
+template<typename T>
+inline long double snr_db(const Metrics<T> &m){
+    const long double sum_sq_error = static_cast<long double>(m.sum_sq_error);
+    const long double sum_sq_signal = static_cast<long double>(m.sum_sq_signal);
+
+    if(sum_sq_signal <= 0.0L || sum_sq_error <= 0.0L){
+        return INFINITY;
+    }
+    return 10.0L * std::log10(sum_sq_signal / sum_sq_error);
+}
+
+#endif
@@ -15,64 +15,363 @@
 // IEETA / DETI / University of Aveiro
 //
 #include <iostream>
+#include <iomanip>
 #include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <sndfile.hh>
+#include "audio_io.h"
 
 using namespace std;
 
 constexpr size_t FRAMES_BUFFER_SIZE = 65536; // Buffer for reading/writing frames
+constexpr size_t COPY_BUFFER_SIZE = 1 << 20; // Bytes per read/write when the kernel cannot copy
+
+//------------------------------------------------------------------------------
+// Fast path: the output has the format of the input, so the samples do not
+// need to be decoded. The fmt chunk of the input is written under a new
+// RIFF header, and the data chunk is copied by the kernel (copy_file_range,
+// then sendfile), or with large buffered reads where neither is available.
+// Other chunks (LIST, cue, ...) are dropped, as libsndfile does.
+//------------------------------------------------------------------------------
+struct WavLayout {
+	vector<unsigned char> fmt; // contents of the fmt chunk
+	off_t dataOffset { 0 };
+	uint64_t dataSize { 0 };   // whole frames only
+};
+
+static uint32_t le32(const unsigned char* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void put_le32(vector<unsigned char>& v, uint32_t x) {
+	for(int i = 0 ; i < 4 ; i++)
+		v.push_back(static_cast<unsigned char>(x >> (8 * i)));
+}
+
+static bool read_at(int fd, void* buf, size_t n, off_t offset) {
+	return pread(fd, buf, n, offset) == static_cast<ssize_t>(n);
+}
+
+static bool write_all(int fd, const void* buf, size_t n) {
+	const char* p = static_cast<const char*>(buf);
+	while(n > 0) {
+		ssize_t w = write(fd, p, n);
+		if(w < 0 && errno == EINTR)
+			continue;
+		if(w <= 0)
+			return false;
+		p += w;
+		n -= static_cast<size_t>(w);
+	}
+	return true;
+}
+
+// Finds the fmt and data chunks of a RIFF/WAVE file; false if it is not one
+// (e.g. RF64) or they are missing
+static bool parse_wav(int fd, WavLayout& w) {
+	struct stat st;
+	unsigned char h[12];
+	if(fstat(fd, &st) != 0 || !read_at(fd, h, 12, 0) || memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0)
+		return false;
+
+	const uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+	uint64_t pos = 12;
+	while(pos + 8 <= fileSize) {
+		read_at(fd, h, 8, static_cast<off_t>(pos));
+		const uint32_t size = le32(h + 4);
+		if(memcmp(h, "fmt ", 4) == 0) {
+			if(size < 16)
+				return false;
+			w.fmt.resize(size);
+			if(!read_at(fd, w.fmt.data(), size, static_cast<off_t>(pos + 8)))
+				return false;
+		}
+		else if(memcmp(h, "data", 4) == 0) {
+			if(w.fmt.empty())
+				return false;
+			// Streamed files may have a size larger than the file, or a
+			// partial frame at the end
+			const uint64_t blockAlign = max(1, w.fmt[12] | (w.fmt[13] << 8));
+			w.dataOffset = static_cast<off_t>(pos + 8);
+			w.dataSize = min<uint64_t>(size, fileSize - (pos + 8)) / blockAlign * blockAlign;
+			return true;
+		}
+		pos += 8 + static_cast<uint64_t>(size) + (size & 1);
+	}
+	return false;
+}
+
+static bool write_wav_header(int fd, const WavLayout& w) {
+	const uint32_t fmtSize = static_cast<uint32_t>(w.fmt.size());
+	const uint32_t dataSize = static_cast<uint32_t>(w.dataSize);
+	vector<unsigned char> h { 'R', 'I', 'F', 'F' };
+	put_le32(h, 4 + 8 + fmtSize + (fmtSize & 1) + 8 + dataSize + (dataSize & 1));
+	h.insert(h.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+	put_le32(h, fmtSize);
+	h.insert(h.end(), w.fmt.begin(), w.fmt.end());
+	if(fmtSize & 1)
+		h.push_back(0);
+	h.insert(h.end(), { 'd', 'a', 't', 'a' });
+	put_le32(h, dataSize);
+	return write_all(fd, h.data(), h.size());
+}
+
+// Appends n bytes of "in", from "offset", to "out"; returns how they were
+// copied, or nullptr on error. Each method takes over from where the
+// previous one stopped.
+static const char* copy_range(int in, off_t offset, int out, uint64_t n) {
+	const char* method { "read/write" };
+#ifdef __linux__
+	for(bool kernel : { true, false }) {
+		while(n > 0) {
+			size_t chunk = static_cast<size_t>(min<uint64_t>(n, 1 << 30));
+			ssize_t r = kernel ? copy_file_range(in, &offset, out, nullptr, chunk, 0)
+			                   : sendfile(out, in, &offset, chunk);
+			if(r < 0 && errno == EINTR)
+				continue;
+			if(r <= 0)
+				break; // not supported here (e.g. across file systems): next method
+			n -= static_cast<uint64_t>(r);
+			method = kernel ? "copy_file_range" : "sendfile";
+		}
+		if(n == 0)
+			return method;
+	}
+#endif
+	vector<char> buf(COPY_BUFFER_SIZE);
+	while(n > 0) {
+		size_t chunk = static_cast<size_t>(min<uint64_t>(n, buf.size()));
+		ssize_t r = pread(in, buf.data(), chunk, offset);
+		if(r < 0 && errno == EINTR)
+			continue;
+		if(r <= 0 || !write_all(out, buf.data(), static_cast<size_t>(r)))
+			return nullptr;
+		offset += r;
+		n -= static_cast<uint64_t>(r);
+		method = "read/write";
+	}
+	return method;
+}
+
+//------------------------------------------------------------------------------
+// --verify: XXH64 (seed 0) of the data chunks of both files
+//------------------------------------------------------------------------------
+class XXH64 {
+  private:
+	static constexpr uint64_t P1 { 11400714785074694791ULL };
+	static constexpr uint64_t P2 { 14029467366897019727ULL };
+	static constexpr uint64_t P3 { 1609587929392839161ULL };
+	static constexpr uint64_t P4 { 9650029242287828579ULL };
+	static constexpr uint64_t P5 { 2870177450012600261ULL };
+
+	uint64_t v[4] { P1 + P2, P2, 0, 0 - P1 };
+	unsigned char mem[32];
+	size_t memSize { 0 };
+	uint64_t total { 0 };
+
+	static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+	static uint64_t read64(const unsigned char* p) { uint64_t x; memcpy(&x, p, 8); return x; } // little-endian hosts
+	static uint64_t read32(const unsigned char* p) { uint32_t x; memcpy(&x, p, 4); return x; }
+	static uint64_t round(uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; }
+	static uint64_t merge(uint64_t acc, uint64_t val) { return (acc ^ round(0, val)) * P1 + P4; }
+
+	void stripe(const unsigned char* p) {
+		for(int i = 0 ; i < 4 ; i++)
+			v[i] = round(v[i], read64(p + 8 * i));
+	}
+
+  public:
+	void update(const unsigned char* p, size_t n) {
+		total += n;
+		if(memSize > 0) {
+			size_t take = min(n, 32 - memSize);
+			memcpy(mem + memSize, p, take);
+			memSize += take;
+			p += take;
+			n -= take;
+			if(memSize < 32)
+				return;
+			stripe(mem);
+			memSize = 0;
+		}
+		for( ; n >= 32 ; p += 32, n -= 32)
+			stripe(p);
+		memcpy(mem, p, n);
+		memSize = n;
+	}
+
+	uint64_t digest() const {
+		uint64_t h;
+		if(total >= 32) {
+			h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+			for(int i = 0 ; i < 4 ; i++)
+				h = merge(h, v[i]);
+		} else
+			h = v[2] + P5;
+		h += total;
+		size_t i = 0;
+		for( ; i + 8 <= memSize ; i += 8)
+			h = rotl(h ^ round(0, read64(mem + i)), 27) * P1 + P4;
+		if(i + 4 <= memSize) {
+			h = rotl(h ^ (read32(mem + i) * P1), 23) * P2 + P3;
+			i += 4;
+		}
+		for( ; i < memSize ; i++)
+			h = rotl(h ^ (mem[i] * P5), 11) * P1;
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+};
+
+// Hash of the data chunk of a WAV file; false if it cannot be read
+static bool hash_data(const string& fileName, uint64_t& hash) {
+	int fd = open(fileName.c_str(), O_RDONLY);
+	WavLayout w;
+	if(fd < 0 || !parse_wav(fd, w)) {
+		if(fd >= 0)
+			close(fd);
+		return false;
+	}
+	XXH64 h;
+	vector<unsigned char> buf(COPY_BUFFER_SIZE);
+	bool ok { true };
+	for(uint64_t done = 0 ; done < w.dataSize && ok ; ) {
+		size_t chunk = static_cast<size_t>(min<uint64_t>(w.dataSize - done, buf.size()));
+		ok = read_at(fd, buf.data(), chunk, w.dataOffset + static_cast<off_t>(done));
+		h.update(buf.data(), chunk);
+		done += chunk;
+	}
+	close(fd);
+	hash = h.digest();
+	return ok;
+}
+
+// Copies the data chunk of the input under a new header; returns the method
+// used, or nullptr if the input cannot be copied that way
+static const char* fast_copy(const string& inFile, const string& outFile, uint64_t& bytes) {
+	int in = open(inFile.c_str(), O_RDONLY);
+	if(in < 0)
+		return nullptr;
+	WavLayout w;
+	const char* method { nullptr };
+	if(parse_wav(in, w)) {
+		int out = open(outFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(out >= 0) {
+			if(write_wav_header(out, w))
+				method = copy_range(in, w.dataOffset, out, w.dataSize);
+			if(method && (w.dataSize & 1) && !write_all(out, "", 1)) // pad byte
+				method = nullptr;
+			if(close(out) != 0)
+				method = nullptr;
+		}
+	}
+	close(in);
+	bytes = w.dataSize;
+	return method;
+}
+
+// Slow path: decode and re-encode through libsndfile, in the native sample type
+template <typename T>
+static void sndfile_copy(SndfileHandle& sfhIn, SndfileHandle& sfhOut) {
+	size_t nFrames;
+	T* samples;
+	BasicBlockReader<T> reader { sfhIn, FRAMES_BUFFER_SIZE };
+	BlockWriter writer { sfhOut };
+	while((nFrames = reader.next(samples)))
+		writer.write(samples, nFrames);
+}
 
 int main(int argc, char *argv[]) {
 
 	bool verbose { false };
+	bool decode { false };
+	bool verify { false };
 
 	if(argc < 3) {
 		cerr << "Usage: wav_cp [ -v (verbose) ]\n";
-		cerr << "              wavFileIn wavFileOut\n";
+		cerr << "              [ -decode (re-encode the samples through libsndfile) ]\n";
+		cerr << "              [ --verify (compare the XXH64 hashes of the audio data) ]\n";
+		cerr << "              wavFileIn wavFileOut ('-': stdin/stdout, through libsndfile)\n";
 		return 1;
 	}
 
-	for(int n = 1 ; n < argc ; n++)
-		if(string(argv[n]) == "-v") {
+	for(int n = 1 ; n < argc - 2 ; n++) {
+		if(string(argv[n]) == "-v")
 			verbose = true;
-			break;
-		}
-
-	SndfileHandle sfhIn { argv[argc-2] };
-	if(sfhIn.error()) {
-		cerr << "Error: invalid input file\n";
-		return 1;
-    }
+		if(string(argv[n]) == "-decode")
+			decode = true;
+		if(string(argv[n]) == "--verify")
+			verify = true;
+	}
 
-	if((sfhIn.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV) {
-		cerr << "Error: file is not in WAV format\n";
+	const string inFile { argv[argc-2] };
+	const string outFile { argv[argc-1] };
+	const bool stdio { is_stdio(inFile) || is_stdio(outFile) };
+	if(verify && stdio) {
+		cerr << "Error: --verify needs files, not stdin/stdout\n";
 		return 1;
 	}
-
-	if((sfhIn.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16) {
-		cerr << "Error: file is not in PCM_16 format\n";
+	ostream& msg = is_stdio(outFile) ? cerr : cout;
+	SndfileHandle sfhIn { open_input(inFile, StreamFormat{}) };
+	string error = check_wav(sfhIn);
+	if(!error.empty()) {
+		cerr << "Error: " << error << "\n";
 		return 1;
 	}
 
 	if(verbose) {
-		cout << "Input file has:\n";
-		cout << '\t' << sfhIn.frames() << " frames\n";
-		cout << '\t' << sfhIn.samplerate() << " samples per second\n";
-		cout << '\t' << sfhIn.channels() << " channels\n";
+		msg << "Input file has:\n";
+		msg << '\t' << sfhIn.frames() << " frames\n";
+		msg << '\t' << sfhIn.samplerate() << " samples per second\n";
+		msg << '\t' << sfhIn.channels() << " channels\n";
 	}
 
-	SndfileHandle sfhOut { argv[argc-1], SFM_WRITE, sfhIn.format(),
-	  sfhIn.channels(), sfhIn.samplerate() };
-	if(sfhOut.error()) {
-		cerr << "Error: invalid output file\n";
-		return 1;
-    }
+	uint64_t bytes { 0 };
+	const char* method { decode || stdio ? nullptr : fast_copy(inFile, outFile, bytes) };
+	if(method) {
+		if(verbose)
+			msg << "Copied " << bytes << " bytes of audio data (" << method << ")\n";
+	} else {
+		SndfileHandle sfhOut { open_output(outFile, StreamFormat{}, sfhIn.format(),
+		  sfhIn.channels(), sfhIn.samplerate()) };
+		if(sfhOut.error()) {
+			cerr << "Error: invalid output file\n";
+			return 1;
+		}
+		with_sample_type(sample_type(sfhIn), [&](auto zero) {
+			sndfile_copy<decltype(zero)>(sfhIn, sfhOut);
+		});
+		if(verbose)
+			msg << "Copied " << sfhIn.frames() << " frames (libsndfile)\n";
+	}
 
-	size_t nFrames;
-	vector<short> samples(FRAMES_BUFFER_SIZE * sfhIn.channels());
-	while((nFrames = sfhIn.readf(samples.data(), FRAMES_BUFFER_SIZE)))
-		sfhOut.writef(samples.data(), nFrames);
+	if(verify) {
+		uint64_t hIn, hOut;
+		if(!hash_data(inFile, hIn) || !hash_data(outFile, hOut)) {
+			cerr << "Error: cannot verify (not a RIFF/WAVE file)\n";
+			return 1;
+		}
+		if(hIn != hOut) {
+			cerr << "Error: audio data differs (xxh64 " << hex << setw(16) << setfill('0') << hIn
+			     << " in, " << setw(16) << hOut << " out)\n";
+			return 1;
+		}
+		cout << "Verified: xxh64 " << hex << setw(16) << setfill('0') << hOut << dec << "\n";
+	}
 
 	return 0;
 }
-
@@ -17,22 +17,104 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include <fftw3.h>
 #include <sndfile.hh>
+#include <thread>
+#include "audio_io.h"
+#include "thread_pool.h"
+#include "interleave.h"
+#include "scratch_arena.h"
 
 using namespace std;
 
+// Blocks are read "groupBlocks" at a time: c1 c2 ... cn c1 c2 ... cn ...
+// Note: A frame is a group c1 c2 ... cn
+// Each group is transformed, truncated, inverted and written before the
+// next one is read, so memory does not depend on the length of the input.
+// T is the native sample type of the input, which the output keeps.
+// Scratch memory comes from "arenas": one per worker, the last one for the
+// calling thread.
+template <typename T>
+static void dct_stream(SndfileHandle& sfhIn, SndfileHandle& sfhOut, ThreadPool& pool, vector<ScratchArena>& arenas,
+  size_t groupBlocks, size_t bs, double dctFrac, BlockLatency& latency) {
+	const size_t nChannels { static_cast<size_t>(sfhIn.channels()) };
+	BasicBlockReader<T> reader { sfhIn, groupBlocks * bs };
+	BlockWriter writer { sfhOut };
+	T* samples;
+
+	// One DCT buffer per (block, channel) of a group; the stride keeps all of
+	// them with the alignment of the buffer the plans were made for
+	const size_t stride { (bs + 7) & ~static_cast<size_t>(7) };
+	ScratchArena::Scope scope { arenas.back() };
+	double* x = arenas.back().alloc<double>(groupBlocks * nChannels * stride);
+
+	fftw_plan plan_d = fftw_plan_r2r_1d(bs, x, x, FFTW_REDFT10, FFTW_ESTIMATE);
+	fftw_plan plan_i = fftw_plan_r2r_1d(bs, x, x, FFTW_REDFT01, FFTW_ESTIMATE);
+
+	size_t nFrames;
+	while((nFrames = reader.next(samples)) > 0) {
+		latency.start();
+		size_t nBlocks { (nFrames + bs - 1) / bs };
+
+		// Do zero padding, if necessary (last block)
+		fill(samples + nFrames * nChannels, samples + nBlocks * bs * nChannels, T(0));
+
+		// Every (block, channel) pair is a task
+		for(size_t n = 0 ; n < nBlocks ; n++)
+			for(size_t c = 0 ; c < nChannels ; c++)
+				pool.submit([&, n, c](unsigned) {
+					double* xc = x + (n * nChannels + c) * stride;
+					deinterleave_channel(&samples[n * bs * nChannels], nChannels, c, bs, xc);
+
+					// Direct DCT
+					fftw_execute_r2r(plan_d, xc, xc);
+
+					// Keep only "dctFrac" of the "low frequency" coefficients
+					for(size_t k = 0 ; k < bs ; k++)
+						xc[k] = k < bs * dctFrac ? xc[k] / (bs << 1) : 0.0;
+
+					// Inverse DCT
+					fftw_execute_r2r(plan_i, xc, xc);
+				});
+		pool.wait();
+
+		// Back to interleaved samples, one task per block (its channels share cache lines)
+		for(size_t n = 0 ; n < nBlocks ; n++)
+			pool.submit([&, n](unsigned worker) {
+				ScratchArena::Scope blockScope { arenas[worker] };
+				const double** channels = arenas[worker].alloc<const double*>(nChannels);
+				for(size_t c = 0 ; c < nChannels ; c++)
+					channels[c] = x + (n * nChannels + c) * stride;
+				interleave_round(channels, nChannels, bs, &samples[n * bs * nChannels]);
+			});
+		pool.wait();
+
+		latency.stop();
+		writer.write(samples, nFrames);
+	}
+
+	fftw_destroy_plan(plan_d);
+	fftw_destroy_plan(plan_i);
+}
+
 int main(int argc, char *argv[]) {
 
 	bool verbose { false };
 	size_t bs { 1024 };
 	double dctFrac { 0.2 };
+	StreamFormat streamFmt;
+	bool reportLatency { false };
+	unsigned nThreads { max(1u, thread::hardware_concurrency()) };
 
 	if(argc < 3) {
 		cerr << "Usage: wav_dct [ -v (verbose) ]\n";
 		cerr << "               [ -bs blockSize (def 1024) ]\n";
 		cerr << "               [ -frac dctFraction (def 0.2) ]\n";
-		cerr << "               wavFileIn wavFileOut\n";
+		cerr << "               [ -raw channels:samplerate (headerless PCM_16) ]\n";
+		cerr << "               [ -lat (report per-block latency) ]\n";
+		cerr << "               [ -j threads (def: all cores) ]\n";
+		cerr << "               wavFileIn wavFileOut ('-': stdin/stdout)\n";
 		return 1;
 	}
 
@@ -54,83 +136,72 @@ int main(int argc, char *argv[]) {
 			break;
 		}
 
-	SndfileHandle sfhIn { argv[argc-2] };
-	if(sfhIn.error()) {
-		cerr << "Error: invalid input file\n";
-		return 1;
-    }
+	for(int n = 1 ; n < argc - 2 ; n++)
+		if(string(argv[n]) == "-raw") {
+			if(!streamFmt.parse(argv[n+1])) {
+				cerr << "Error: -raw expects channels:samplerate\n";
+				return 1;
+			}
+			break;
+		}
 
-	if((sfhIn.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV) {
-		cerr << "Error: file is not in WAV format\n";
-		return 1;
-	}
+	for(int n = 1 ; n < argc - 2 ; n++)
+		if(string(argv[n]) == "-j") {
+			nThreads = static_cast<unsigned>(max(1, atoi(argv[n+1])));
+			break;
+		}
+
+	for(int n = 1 ; n < argc - 2 ; n++)
+		if(string(argv[n]) == "-lat") {
+			reportLatency = true;
+			break;
+		}
 
-	if((sfhIn.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16) {
-		cerr << "Error: file is not in PCM_16 format\n";
+	SndfileHandle sfhIn = open_input(argv[argc-2], streamFmt);
+	string error = check_wav(sfhIn, true);
+	if(!error.empty()) {
+		cerr << "Error: " << error << "\n";
 		return 1;
 	}
 
-	SndfileHandle sfhOut { argv[argc-1], SFM_WRITE, sfhIn.format(),
-	  sfhIn.channels(), sfhIn.samplerate() };
+	SndfileHandle sfhOut = open_output(argv[argc-1], streamFmt, sfhIn.format(),
+	  sfhIn.channels(), sfhIn.samplerate());
 	if(sfhOut.error()) {
 		cerr << "Error: invalid output file\n";
 		return 1;
     }
 
+	// stdout may be carrying the audio stream
+	ostream& msg = is_stdio(argv[argc-1]) ? cerr : cout;
 	if(verbose) {
-		cout << "Input file has:\n";
-		cout << '\t' << sfhIn.frames() << " frames\n";
-		cout << '\t' << sfhIn.samplerate() << " samples per second\n";
-		cout << '\t' << sfhIn.channels() << " channels\n";
+		msg << "Input file has:\n";
+		msg << '\t' << sfhIn.frames() << " frames\n";
+		msg << '\t' << sfhIn.samplerate() << " samples per second\n";
+		msg << '\t' << sfhIn.channels() << " channels\n";
 	}
 
-	size_t nChannels { static_cast<size_t>(sfhIn.channels()) };
-	size_t nFrames { static_cast<size_t>(sfhIn.frames()) };
-
-	// Read all samples: c1 c2 ... cn c1 c2 ... cn ...
-	// Note: A frame is a group c1 c2 ... cn
-	vector<short> samples(nChannels * nFrames);
-	sfhIn.readf(samples.data(), nFrames);
-
-	size_t nBlocks { static_cast<size_t>(ceil(static_cast<double>(nFrames) / bs)) };
-
-	// Do zero padding, if necessary
-	samples.resize(nBlocks * bs * nChannels);
-
-	// Vector for holding all DCT coefficients, channel by channel
-	vector<vector<double>> x_dct(nChannels, vector<double>(nBlocks * bs));
-
-	// Vector for holding DCT computations
-	vector<double> x(bs);
+	int samplerate { sfhIn.samplerate() };
 
-	// Direct DCT
-	fftw_plan plan_d = fftw_plan_r2r_1d(bs, x.data(), x.data(), FFTW_REDFT10, FFTW_ESTIMATE);
-	for(size_t n = 0 ; n < nBlocks ; n++)
-		for(size_t c = 0 ; c < nChannels ; c++) {
-			for(size_t k = 0 ; k < bs ; k++)
-				x[k] = samples[(n * bs + k) * nChannels + c];
-
-			fftw_execute(plan_d);
-			// Keep only "dctFrac" of the "low frequency" coefficients
-			for(size_t k = 0 ; k < bs * dctFrac ; k++)
-				x_dct[c][n * bs + k] = x[k] / (bs << 1);
+	ThreadPool pool(nThreads);
+	const size_t groupBlocks { 2 * pool.size() };
+	BlockLatency latency;
+	vector<ScratchArena> arenas(pool.size() + 1);
+	with_sample_type(sample_type(sfhIn), [&](auto zero) {
+		dct_stream<decltype(zero)>(sfhIn, sfhOut, pool, arenas, groupBlocks, bs, dctFrac, latency);
+	});
 
+	if(verbose) {
+		size_t highWater { 0 }, mallocs { 0 };
+		for(const ScratchArena& a : arenas) {
+			highWater += a.high_water();
+			mallocs += a.mallocs();
 		}
+		msg << "Scratch memory: " << highWater << " bytes (high-water, all threads), " << mallocs << " allocations\n";
+	}
 
-	// Inverse DCT
-	fftw_plan plan_i = fftw_plan_r2r_1d(bs, x.data(), x.data(), FFTW_REDFT01, FFTW_ESTIMATE);
-	for(size_t n = 0 ; n < nBlocks ; n++)
-		for(size_t c = 0 ; c < nChannels ; c++) {
-			for(size_t k = 0 ; k < bs ; k++)
-				x[k] = x_dct[c][n * bs + k];
-
-			fftw_execute(plan_i);
-			for(size_t k = 0 ; k < bs ; k++)
-				samples[(n * bs + k) * nChannels + c] = static_cast<short>(round(x[k]));
-
-		}
+	if(reportLatency)
+		latency.report(cerr, groupBlocks * bs, samplerate);
 
-	sfhOut.writef(samples.data(), sfhIn.frames());
 	return 0;
 }
 
@@ -2,199 +2,395 @@
 #include <vector>
 #include <cmath>
 #include <string>
+#include <sstream>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <limits>
+#include <chrono>
 #include <sndfile.hh>
 #include "wav_hist.h"
+#include "wav_effects.h"
+#include "audio_io.h"
+#include "batch.h"
+#include "stats.h"
+#include "scratch_arena.h"
 
 using namespace std;
 
-constexpr size_t FRAMES_BUFFER_SIZE = 65536; // buffer for reading/writing frames
+constexpr size_t FRAMES_BUFFER_SIZE = 4096; // frames per block through the chain (default)
+
+struct StageSpec {
+    string name;
+    vector<string> params;
+};
 
 //------------------------------------------------------------------------------
-// Echo effect
+// Builds one effect; returns nullptr for unknown effects or missing parameters
 //------------------------------------------------------------------------------
-void applyEcho(vector<short>& samples, int channels, int samplerate, double delaySec, double decay) {
-    size_t delaySamples = static_cast<size_t>(delaySec * samplerate);
-    vector<short> original = samples;
-
-    for(size_t i = delaySamples; i < samples.size() / channels; i++) {
-        for(int c = 0; c < channels; c++) {
-            size_t idx = i * channels + c;
-            size_t delayedIdx = (i - delaySamples) * channels + c;
-            int val = static_cast<int>(samples[idx]) + static_cast<int>(original[delayedIdx] * decay);
-            if(val > 32767) val = 32767;
-            if(val < -32768) val = -32768;
-            samples[idx] = static_cast<short>(val);
+static unique_ptr<Effect> make_effect(const StageSpec& spec, int channels, int samplerate) {
+    const string& effect = spec.name;
+    const vector<string>& p = spec.params;
+
+    if(effect == "echo" && p.size() >= 2) {
+        double delay = atof(p[0].c_str());
+        double decay = atof(p[1].c_str());
+        return make_unique<Echo>(channels, samplerate, delay, decay);
+    }
+    else if(effect == "multiecho" && p.size() >= 3) {
+        double delay = atof(p[0].c_str());
+        double decay = atof(p[1].c_str());
+        int repeats = atoi(p[2].c_str());
+        return make_unique<MultiEcho>(channels, samplerate, delay, decay, repeats);
+    }
+    else if(effect == "tremolo" && p.size() >= 2) {
+        double freq = atof(p[0].c_str());
+        double depth = atof(p[1].c_str());
+        return make_unique<AmplitudeMod>(channels, samplerate, freq, depth);
+    }
+    else if(effect == "vib" && p.size() >= 2) {
+        double maxDelay = atof(p[0].c_str());
+        double freq = atof(p[1].c_str());
+        return make_unique<TimeVaryingDelay>(channels, samplerate, maxDelay, freq);
+    }
+    else if(effect == "reverb" && p.size() >= 2) {
+        SndfileHandle sfhIR { p[0] };
+        if(sfhIR.error() || sfhIR.frames() <= 0) {
+            cerr << "Error: cannot read impulse response " << p[0] << "\n";
+            return nullptr;
         }
+        if(sfhIR.channels() != 1 && sfhIR.channels() != channels) {
+            cerr << "Error: impulse response must be mono or have " << channels << " channels\n";
+            return nullptr;
+        }
+        if(sfhIR.samplerate() != samplerate)
+            cerr << "Warning: impulse response sample rate differs from the input\n";
+        vector<float> ir(sfhIR.frames() * sfhIR.channels());
+        sfhIR.readf(ir.data(), sfhIR.frames());
+        double mix = atof(p[1].c_str());
+        return make_unique<ConvolutionReverb>(channels, ir, sfhIR.channels(), mix);
     }
+    return nullptr;
 }
 
-//------------------------------------------------------------------------------
-// Multiple echoes
-//------------------------------------------------------------------------------
-void applyMultiEcho(vector<short>& samples, int channels, int samplerate,
-                    double delaySec, double decay, int repeats) {
-    for(int i = 0; i < repeats; i++) {
-        applyEcho(samples, channels, samplerate, delaySec * (i + 1), pow(decay, i + 1));
+// "echo:0.3:0.6,tremolo:5:0.5" -> { echo 0.3 0.6 } { tremolo 5 0.5 }
+static vector<StageSpec> parse_chain(const string& chain) {
+    vector<StageSpec> specs;
+    stringstream stages(chain);
+    string stage, field;
+    while(getline(stages, stage, ',')) {
+        stringstream fields(stage);
+        StageSpec spec;
+        getline(fields, spec.name, ':');
+        while(getline(fields, field, ':'))
+            spec.params.push_back(field);
+        specs.push_back(spec);
     }
+    return specs;
 }
 
-//------------------------------------------------------------------------------
-// Tremolo (Amplitude modulation)
-//------------------------------------------------------------------------------
-void applyAmplitudeMod(vector<short>& samples, int channels, int samplerate, double freq, double depth) {
-    for(size_t i = 0; i < samples.size() / channels; i++) {
-        double mod = 1.0 + depth * sin(2 * M_PI * freq * i / samplerate);
-        for(int c = 0; c < channels; c++) {
-            size_t idx = i * channels + c;
-            int val = static_cast<int>(samples[idx] * mod);
-            if(val > 32767) val = 32767;
-            if(val < -32768) val = -32768;
-            samples[idx] = static_cast<short>(val);
-        }
+// Chain file: one stage per line, "name param param ...", '#' starts a comment
+static bool read_chain_file(const string& fileName, vector<StageSpec>& specs) {
+    ifstream in(fileName);
+    if(!in)
+        return false;
+
+    string line;
+    while(getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        stringstream fields(line);
+        StageSpec spec;
+        if(!(fields >> spec.name))
+            continue;
+        string field;
+        while(fields >> field)
+            spec.params.push_back(field);
+        specs.push_back(spec);
     }
+    return true;
 }
 
-//------------------------------------------------------------------------------
-// Vibrato (Time-varying delay)
-//------------------------------------------------------------------------------
-void applyTimeVaryingDelay(vector<short>& samples, int channels, int samplerate,
-                           double maxDelaySec, double freq) {
-    size_t maxDelaySamples = static_cast<size_t>(maxDelaySec * samplerate);
-    vector<short> original = samples;
-
-    for(size_t i = maxDelaySamples; i < samples.size() / channels; i++) {
-        double delaySamples = maxDelaySamples * (0.5 + 0.5 * sin(2 * M_PI * freq * i / samplerate));
-        size_t delayedIdx = static_cast<size_t>(i - delaySamples);
-        for(int c = 0; c < channels; c++) {
-            size_t idx = i * channels + c;
-            if(delayedIdx * channels + c < original.size())
-                samples[idx] = original[delayedIdx * channels + c];
-        }
+template <typename T>
+static void write_hist(const string& fileName, const BasicWAVHist<T>& hist, const string& label) {
+    ofstream out(fileName);
+    if(!out) {
+        cerr << "Error: cannot write histogram " << label << " file\n";
+    } else {
+        out.precision(numeric_limits<T>::max_digits10);
+        for(const auto& [value, count] : hist.getChannelCounts(0))
+            out << value << '\t' << count << '\n';
     }
 }
 
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " [ -hist bin_size ] [ -bs frames ] <chain> <input.wav> <output.wav>\n";
+    cerr << "       " << prog << " [ -hist bin_size ] [ -bs frames ] -c <chain file> <input.wav> <output.wav>\n";
+    cerr << "       " << prog << " <effect> <input.wav> <output.wav> [params...] [bin_size]\n";
+    cerr << "       " << prog << " [ -j threads ] [ -hist bin_size ] [ -bs frames ] <chain> | -c <chain file> -batch list.txt\n";
+    cerr << "Effects:\n"
+         << "  echo <delay_sec> <decay>\n"
+         << "  multiecho <delay_sec> <decay> <repeats>\n"
+         << "  tremolo <freq_Hz> <depth>\n"
+         << "  vib <max_delay_sec> <freq_Hz>\n"
+         << "  reverb <impulse_response.wav> <mix 0..1>\n";
+    cerr << "Chain:\n"
+         << "  effect[:param...][,effect[:param...]...], e.g. echo:0.3:0.6,tremolo:5:0.5\n"
+         << "  (chain file: one effect per line, parameters separated by spaces)\n";
+    cerr << "Optional:\n"
+         << "  -hist bin_size: write histograms (channel 0) before and after the chain\n"
+         << "  -bs frames: block size (default = " << FRAMES_BUFFER_SIZE << ")\n"
+         << "  -raw channels:samplerate: raw PCM_16 input and output instead of WAV\n"
+         << "  -lat: report the worst-case block processing latency (stderr)\n"
+         << "  --stats json: per-stage times and counters, as JSON on stderr\n"
+         << "  '-' as input/output file: stdin/stdout\n"
+         << "  -batch list.txt: one 'input.wav output.wav' pair per line, -j threads (default: all cores)\n"
+         << "  bin_size (single effect form, default = 1; histograms are always written)\n";
+}
+
+struct RunOptions {
+    vector<StageSpec> specs;
+    size_t bin_size = 0; // 0: no histograms
+    size_t blockFrames = FRAMES_BUFFER_SIZE;
+    StreamFormat streamFmt;
+    bool reportLatency = false;
+    bool stats = false; // --stats json
+};
+
+// Sample buffers of one thread, reused for every file of a batch
+struct BlockBuffers {
+    AnyReaderBuffers samples;
+    ScratchArena arena; // float working copy of a block
+    Stats stats;
+};
+
 //------------------------------------------------------------------------------
-// Main
+// Streams one file through the chain in its native sample type T
 //------------------------------------------------------------------------------
-int main(int argc, char* argv[]) {
-    if(argc < 4) {
-        cerr << "Usage: " << argv[0] << " <effect> <input.wav> <output.wav> [params...] [bin_size]\n";
-        cerr << "Effects:\n"
-             << "  echo <delay_sec> <decay>\n"
-             << "  multiecho <delay_sec> <decay> <repeats>\n"
-             << "  tremolo <freq_Hz> <depth>\n"
-             << "  vib <max_delay_sec> <freq_Hz>\n";
-        cerr << "Optional:\n"
-             << "  bin_size (default = 1)\n";
-        return 1;
+template <typename T>
+static void stream_file(SndfileHandle& sndFileIn, SndfileHandle& sndFileOut, EffectChain& chain, const string& effect,
+                        const string& outputFile, const RunOptions& opt, BlockBuffers& buf, ostream* log, BatchResult& result) {
+    const int channels = sndFileIn.channels();
+    const int samplerate = sndFileIn.samplerate();
+
+    // ---- STREAM: [HISTOGRAM BEFORE], CHAIN, [HISTOGRAM AFTER], WRITE ----
+    // Only one block of samples is held; delay effects keep their own history.
+    // The chain works on float samples, converted (and saturated) once per block.
+    const size_t bin_size = opt.bin_size;
+    const size_t blockFrames = opt.blockFrames;
+    unique_ptr<BasicWAVHist<T>> histBefore, histAfter;
+    if(bin_size > 0) {
+        histBefore = make_unique<BasicWAVHist<T>>(sndFileIn, bin_size);
+        histAfter = make_unique<BasicWAVHist<T>>(sndFileIn, bin_size);
     }
+    ScratchArena::Scope scope { buf.arena };
+    float* block = buf.arena.alloc<float>(blockFrames * channels);
+    BasicBlockReader<T> reader { sndFileIn, blockFrames, &buf.samples.get<T>() };
+    BlockWriter writer { sndFileOut };
+    BlockLatency latency;
+    Stats* stats = opt.stats ? &buf.stats : nullptr;
+    T* samples;
+    size_t nFrames;
+    while((nFrames = timed(stats, Stage::Read, [&] { return reader.next(samples); }))) {
+        latency.start();
+        size_t count = nFrames * channels;
+        if(histBefore) histBefore->update(samples, count);
+        timed(stats, Stage::Convert, [&] { samples_to_float(samples, block, count); });
+        timed(stats, Stage::Transform, [&] { chain.process(block, nFrames); });
+        timed(stats, Stage::Quantize, [&] { float_to_samples(block, samples, count); });
+        if(histAfter) histAfter->update(samples, count);
+        latency.stop();
+        timed(stats, Stage::Write, [&] { writer.write(samples, nFrames); });
+        result.frames += nFrames;
+    }
+    result.samplerate = samplerate;
+    stats_count(stats, &Stats::files, 1);
+    stats_count(stats, &Stats::frames, result.frames);
+    stats_count(stats, &Stats::bytesIn, result.frames * channels * sizeof(T));
+    stats_count(stats, &Stats::bytesOut, writer.frames() * channels * sizeof(T));
+    stats_set_max(stats, &Stats::scratchBytes, buf.arena.high_water());
 
-    string effect = argv[1];
-    string inputFile = argv[2];
-    string outputFile = argv[3];
+    if(opt.reportLatency)
+        latency.report(cerr, blockFrames, samplerate);
 
-    // open input
-    SndfileHandle sndFileIn { inputFile };
-    if(sndFileIn.error()) {
-        cerr << "Error: cannot open input file\n";
-        return 1;
-    }
+    if(log)
+        *log << (chain.size() == 1 ? "Effect '" : "Effects '") << effect << "' applied successfully!\n";
 
-    if((sndFileIn.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV ||
-       (sndFileIn.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16) {
-        cerr << "Error: input must be 16-bit PCM WAV\n";
-        return 1;
+    if(bin_size > 0) {
+        // Construct base path for histogram output
+        string basePath = outputFile;
+        size_t dotPos = basePath.find_last_of('.');
+        if(dotPos != string::npos)
+            basePath = basePath.substr(0, dotPos);
+
+        string fileBefore = basePath + "_hist_before_" + effect + ".txt";
+        string fileAfter = basePath + "_hist_after_" + effect + ".txt";
+        write_hist(fileBefore, *histBefore, "before");
+        write_hist(fileAfter, *histAfter, "after");
+
+        if(log) {
+            *log << "Histograms written:\n  " << fileBefore << "\n  " << fileAfter << "\n";
+            *log << "Using bin size = " << bin_size << " (only channel 0)\n";
+        }
     }
+}
+
+//------------------------------------------------------------------------------
+// Applies the chain to one file; messages go to "log" (none if nullptr)
+//------------------------------------------------------------------------------
+static void process_file(const BatchJob& job, const RunOptions& opt, BlockBuffers& buf, ostream* log, BatchResult& result) {
+    const string& outputFile = job.output;
+
+    // open input
+    SndfileHandle sndFileIn = open_input(job.input, opt.streamFmt);
+    result.error = check_wav(sndFileIn, true);
+    if(!result.error.empty())
+        return;
 
-    size_t nFrames = static_cast<size_t>(sndFileIn.frames());
     int channels = sndFileIn.channels();
     int samplerate = sndFileIn.samplerate();
 
-    vector<short> samples(nFrames * channels);
-    sndFileIn.readf(samples.data(), nFrames);
-
-    // Determine bin size (last argument if numeric)
-    size_t bin_size = 1;
-    if(argc > 4) {
-        try {
-            bin_size = static_cast<size_t>(stoi(argv[argc - 1]));
-            if(bin_size < 1) bin_size = 1;
-        } catch(...) {
-            bin_size = 1;
+    // ---- SET UP EFFECT CHAIN ----
+    EffectChain chain;
+    string effect; // effect names joined by '+', used in the histogram file names
+    for(const auto& spec : opt.specs) {
+        unique_ptr<Effect> fx = make_effect(spec, channels, samplerate);
+        if(!fx) {
+            result.error = "invalid effect or missing parameters (" + spec.name + ")";
+            return;
         }
+        chain.add(move(fx));
+        effect += (effect.empty() ? "" : "+") + spec.name;
+    }
+    if(chain.size() == 0) {
+        result.error = "empty effect chain";
+        return;
     }
 
-    // Construct base path for histogram output
-    string basePath = outputFile;
-    size_t dotPos = basePath.find_last_of('.');
-    if(dotPos != string::npos)
-        basePath = basePath.substr(0, dotPos);
+    SndfileHandle sndFileOut = open_output(outputFile, opt.streamFmt, sndFileIn.format(), channels, samplerate);
+    if(sndFileOut.error()) {
+        result.error = "cannot open output file";
+        return;
+    }
 
-    // ---- HISTOGRAM BEFORE EFFECT ----
-    WAVHist histBefore(sndFileIn, bin_size);
-    histBefore.update(samples);
+    with_sample_type(sample_type(sndFileIn), [&](auto zero) {
+        stream_file<decltype(zero)>(sndFileIn, sndFileOut, chain, effect, outputFile, opt, buf, log, result);
+    });
+}
 
-    string fileBefore = basePath + "_hist_before_" + effect + ".txt";
-    {
-        ofstream out(fileBefore);
-        if(!out) {
-            cerr << "Error: cannot write histogram before file\n";
-        } else {
-            for(const auto& [value, count] : histBefore.getChannelCounts(0))
-                out << value << '\t' << count << '\n';
+//------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    // options
+    RunOptions opt;
+    string chainFile;
+    string batchFile;
+    unsigned nThreads = max(1u, thread::hardware_concurrency());
+    vector<string> args;
+    for(int n = 1; n < argc; n++) {
+        string arg = argv[n];
+        if(arg == "-hist" && n + 1 < argc)
+            opt.bin_size = static_cast<size_t>(max(1, atoi(argv[++n])));
+        else if(arg == "-bs" && n + 1 < argc)
+            opt.blockFrames = static_cast<size_t>(max(1, atoi(argv[++n])));
+        else if(arg == "-c" && n + 1 < argc)
+            chainFile = argv[++n];
+        else if(arg == "-raw" && n + 1 < argc) {
+            if(!opt.streamFmt.parse(argv[++n])) {
+                cerr << "Error: -raw expects channels:samplerate\n";
+                return 1;
+            }
         }
+        else if(arg == "-lat")
+            opt.reportLatency = true;
+        else if(arg == "--stats" && n + 1 < argc) {
+            if(!parse_stats_format(argv[++n])) {
+                cerr << "Error: --stats expects json\n";
+                return 1;
+            }
+            opt.stats = true;
+        }
+        else if(arg == "-batch" && n + 1 < argc)
+            batchFile = argv[++n];
+        else if(arg == "-j" && n + 1 < argc)
+            nThreads = static_cast<unsigned>(max(1, atoi(argv[++n])));
+        else
+            args.push_back(arg);
     }
 
-    // ---- APPLY EFFECT ----
-    if(effect == "echo" && argc >= 6) {
-        double delay = atof(argv[4]);
-        double decay = atof(argv[5]);
-        applyEcho(samples, channels, samplerate, delay, decay);
-    }
-    else if(effect == "multiecho" && argc >= 7) {
-        double delay = atof(argv[4]);
-        double decay = atof(argv[5]);
-        int repeats = atoi(argv[6]);
-        applyMultiEcho(samples, channels, samplerate, delay, decay, repeats);
-    }
-    else if(effect == "tremolo" && argc >= 6) {
-        double freq = atof(argv[4]);
-        double depth = atof(argv[5]);
-        applyAmplitudeMod(samples, channels, samplerate, freq, depth);
-    }
-    else if(effect == "vib" && argc >= 6) {
-        double maxDelay = atof(argv[4]);
-        double freq = atof(argv[5]);
-        applyTimeVaryingDelay(samples, channels, samplerate, maxDelay, freq);
-    }
-    else {
-        cerr << "Error: invalid effect or missing parameters\n";
-        return 1;
+    // batch: chain form only, the files come from the list
+    if(!batchFile.empty()) {
+        if(!chainFile.empty()) {
+            if(!read_chain_file(chainFile, opt.specs)) {
+                cerr << "Error: cannot read chain file\n";
+                return 1;
+            }
+        } else if(args.size() == 1) {
+            opt.specs = parse_chain(args[0]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        opt.reportLatency = false;
+        auto t0 = chrono::steady_clock::now();
+        vector<BlockBuffers> buffers(nThreads); // one per worker
+        int status = batch_main(batchFile, nThreads, [&](const BatchJob& job, unsigned worker, BatchResult& result) {
+            process_file(job, opt, buffers[worker], nullptr, result);
+        });
+        if(opt.stats) {
+            Stats total;
+            for(const BlockBuffers& b : buffers)
+                total.add(b.stats);
+            total.write_json(cerr, "wav_effects", nThreads, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+        }
+        return status;
     }
 
-    // ---- HISTOGRAM AFTER EFFECT ----
-    WAVHist histAfter(sndFileIn, bin_size);
-    histAfter.update(samples);
+    string inputFile, outputFile;
+    if(!chainFile.empty() && args.size() >= 2) {
+        if(!read_chain_file(chainFile, opt.specs)) {
+            cerr << "Error: cannot read chain file\n";
+            return 1;
+        }
+        inputFile = args[0];
+        outputFile = args[1];
+    } else if(chainFile.empty() && args.size() >= 3 && args[0].find(':') != string::npos) {
+        opt.specs = parse_chain(args[0]);
+        inputFile = args[1];
+        outputFile = args[2];
+    } else if(chainFile.empty() && args.size() >= 3) {
+        // single effect, parameters after the file names; histograms always on
+        opt.specs.push_back({ args[0], vector<string>(args.begin() + 3, args.end()) });
+        inputFile = args[1];
+        outputFile = args[2];
 
-    string fileAfter = basePath + "_hist_after_" + effect + ".txt";
-    {
-        ofstream out(fileAfter);
-        if(!out) {
-            cerr << "Error: cannot write histogram after file\n";
-        } else {
-            for(const auto& [value, count] : histAfter.getChannelCounts(0))
-                out << value << '\t' << count << '\n';
+        // Determine bin size (last argument if numeric)
+        opt.bin_size = 1;
+        if(args.size() > 3) {
+            try {
+                opt.bin_size = static_cast<size_t>(stoi(args.back()));
+                if(opt.bin_size < 1) opt.bin_size = 1;
+            } catch(...) {
+                opt.bin_size = 1;
+            }
         }
+    } else {
+        usage(argv[0]);
+        return 1;
     }
 
-    // ---- SAVE OUTPUT ----
-    SndfileHandle sndFileOut { outputFile, SFM_WRITE, sndFileIn.format(), channels, samplerate };
-    sndFileOut.writef(samples.data(), nFrames);
-
-    cout << "Effect '" << effect << "' applied successfully!\n";
-    cout << "Histograms written:\n  " << fileBefore << "\n  " << fileAfter << "\n";
-    cout << "Using bin size = " << bin_size << " (only channel 0)\n";
+    // stdout may be carrying the audio stream
+    ostream& msg = is_stdio(outputFile) ? cerr : cout;
+    BlockBuffers buffers;
+    BatchResult result;
+    auto t0 = chrono::steady_clock::now();
+    process_file({ inputFile, outputFile }, opt, buffers, &msg, result);
+    if(!result.error.empty()) {
+        cerr << "Error: " << result.error << "\n";
+        return 1;
+    }
+    if(opt.stats)
+        buffers.stats.write_json(cerr, "wav_effects", 1, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
 
     return 0;
 }
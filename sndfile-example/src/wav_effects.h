@@ -0,0 +1,492 @@
+#ifndef WAVEFFECTS_H
+#define WAVEFFECTS_H
+
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <fftw3.h>
+#include "thread_pool.h" // fftw_planner_mutex
+#include "sample_traits.h"
+
+//------------------------------------------------------------------------------
+// Delay line: the last (maxDelay + 1) frames of a stream, in a ring buffer.
+// tap(0) is the frame pushed last, tap(d) the one pushed d frames before;
+// frames before the start of the stream read as silence.
+//------------------------------------------------------------------------------
+class DelayLine {
+  private:
+    std::vector<float> buf;
+    size_t channels;
+    size_t length;
+    size_t pos = 0; // slot of the next push
+
+  public:
+    DelayLine(size_t maxDelay, size_t channels)
+        : buf((maxDelay + 1) * channels), channels(channels), length(maxDelay + 1) {}
+
+    void push(const float* frame) {
+        std::copy(frame, frame + channels, &buf[pos * channels]);
+        if(++pos == length) pos = 0;
+    }
+
+    const float* tap(size_t delay) const {
+        size_t idx = pos + length - 1 - delay;
+        if(idx >= length) idx -= length;
+        return &buf[idx * channels];
+    }
+};
+
+//------------------------------------------------------------------------------
+// Effects process interleaved blocks in place and keep whatever state they
+// need between blocks, so a stream can be fed to them block by block. Samples
+// are float, in 16-bit units (see samples_to_float() in sample_traits.h), and
+// are not clipped.
+//------------------------------------------------------------------------------
+class Effect {
+  public:
+    virtual ~Effect() = default;
+    virtual void process(float* samples, size_t frames) = 0;
+};
+
+//------------------------------------------------------------------------------
+// Effect chain: every block goes through all the stages before the next block
+// is read, so it stays in cache from the first stage to the last
+//------------------------------------------------------------------------------
+class EffectChain : public Effect {
+  private:
+    std::vector<std::unique_ptr<Effect>> stages;
+
+  public:
+    void add(std::unique_ptr<Effect> stage) {
+        stages.push_back(std::move(stage));
+    }
+
+    size_t size() const {
+        return stages.size();
+    }
+
+    void process(float* samples, size_t frames) override {
+        for(auto& stage : stages)
+            stage->process(samples, frames);
+    }
+};
+
+//------------------------------------------------------------------------------
+// Multi-tap delay: y[i] = sum_t gain_t * x[i - delay_t], all taps read from
+// the input signal in a single pass. The input history is a
+// ring buffer of maxDelay + SUB_BLOCK frames; blocks are processed in
+// sub-blocks of at most SUB_BLOCK frames, for which every tap reads at most
+// two contiguous runs of interleaved samples (split at the wrap point).
+//------------------------------------------------------------------------------
+class MultiTapDelay : public Effect {
+  public:
+    struct Tap {
+        size_t delay; // frames
+        float gain;
+    };
+
+  private:
+    static constexpr size_t SUB_BLOCK = 4096;
+
+    int channels;
+    std::vector<Tap> taps;
+    std::vector<float> ring;   // input history, interleaved
+    size_t length;             // ring length in frames
+    size_t pos = 0;            // ring slot of the next input frame
+    std::vector<float> acc;    // sum of the taps for one sub-block
+
+    void add_tap(const Tap& t, size_t frames) {
+        size_t src = pos + length - t.delay; // ring slot read by the first frame
+        if(src >= length) src -= length;
+        size_t done = 0;
+        while(done < frames) {
+            size_t run = std::min(frames - done, length - src);
+            const float* in = &ring[src * channels];
+            float* out = &acc[done * channels];
+            const float g = t.gain;
+            for(size_t j = 0; j < run * channels; j++)
+                out[j] += g * in[j];
+            done += run;
+            src = 0;
+        }
+    }
+
+  public:
+    MultiTapDelay(int channels, std::vector<Tap> taps)
+        : channels(channels), taps(std::move(taps)), acc(SUB_BLOCK * channels) {
+        size_t maxDelay = 0;
+        for(const auto& t : this->taps)
+            maxDelay = std::max(maxDelay, t.delay);
+        length = maxDelay + SUB_BLOCK;
+        ring.resize(length * channels);
+    }
+
+    void process(float* samples, size_t frames) override {
+        while(frames > 0) {
+            size_t n = std::min(frames, SUB_BLOCK);
+
+            // Append the input to the history (at most two runs)
+            size_t first = std::min(n, length - pos);
+            std::copy(samples, samples + first * channels, &ring[pos * channels]);
+            std::copy(samples + first * channels, samples + n * channels, ring.begin());
+
+            std::fill(acc.begin(), acc.begin() + n * channels, 0.0f);
+            for(const auto& t : taps)
+                add_tap(t, n);
+            std::copy(acc.begin(), acc.begin() + n * channels, samples);
+
+            pos = (pos + n) % length;
+            samples += n * channels;
+            frames -= n;
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Echo effect: y[i] = x[i] + decay * x[i - delay]
+//------------------------------------------------------------------------------
+class Echo : public MultiTapDelay {
+  public:
+    Echo(int channels, int samplerate, double delaySec, double decay)
+        : MultiTapDelay(channels, { { 0, 1.0f }, { static_cast<size_t>(delaySec * samplerate), static_cast<float>(decay) } }) {}
+};
+
+//------------------------------------------------------------------------------
+// Multiple echoes: the cascade of echoes with delays delay*(i+1) and gains
+// decay^(i+1), i = 0..repeats-1, each applied to the output of the previous
+// (exactly as "repeats" Echo effects in a row). All the stages run on one
+// sub-block of at most SUB_BLOCK frames before the next one, so the block is
+// read from memory once for the whole cascade and costs one multiply-add per
+// sample and stage. Each stage keeps a ring buffer of its input of
+// delay_i + SUB_BLOCK frames.
+//------------------------------------------------------------------------------
+class MultiEcho : public Effect {
+  private:
+    static constexpr size_t SUB_BLOCK = 4096;
+
+    struct Stage {
+        size_t delay;            // frames
+        float gain;
+        std::vector<float> ring; // input history of the stage, interleaved
+        size_t length;           // ring length in frames
+        size_t pos = 0;          // ring slot of the next input frame
+    };
+
+    int channels;
+    std::vector<Stage> stages;
+
+    // y[i] = x[i] + gain * x[i - delay], in place, for at most SUB_BLOCK frames
+    void apply(Stage& s, float* samples, size_t frames) {
+        const size_t ch = static_cast<size_t>(channels);
+
+        // Append the input to the history (at most two runs)
+        size_t first = std::min(frames, s.length - s.pos);
+        std::copy(samples, samples + first * ch, &s.ring[s.pos * ch]);
+        std::copy(samples + first * ch, samples + frames * ch, s.ring.begin());
+
+        size_t src = s.pos + s.length - s.delay; // ring slot read by the first frame
+        if(src >= s.length) src -= s.length;
+        size_t done = 0;
+        while(done < frames) {
+            size_t run = std::min(frames - done, s.length - src);
+            const float* in = &s.ring[src * ch];
+            float* out = samples + done * ch;
+            const float g = s.gain;
+            for(size_t j = 0; j < run * ch; j++)
+                out[j] += g * in[j];
+            done += run;
+            src = 0;
+        }
+        s.pos = (s.pos + frames) % s.length;
+    }
+
+  public:
+    MultiEcho(int channels, int samplerate, double delaySec, double decay, int repeats) : channels(channels) {
+        for(int i = 0; i < repeats; i++) {
+            Stage s;
+            s.delay = static_cast<size_t>(delaySec * (i + 1) * samplerate);
+            s.gain = static_cast<float>(std::pow(decay, i + 1));
+            s.length = s.delay + SUB_BLOCK;
+            s.ring.resize(s.length * channels);
+            stages.push_back(std::move(s));
+        }
+    }
+
+    void process(float* samples, size_t frames) override {
+        while(frames > 0) {
+            size_t n = std::min(frames, SUB_BLOCK);
+            for(auto& s : stages)
+                apply(s, samples, n);
+            samples += n * channels;
+            frames -= n;
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Sine LFO: sin(2*pi*freq*n/samplerate) for consecutive frames n, generated by
+// LANES interleaved phase rotators (each advancing LANES frames per step, so
+// the loop vectorizes). The phase is recomputed exactly at the start of every
+// call, which keeps the rotation error from building up over long streams.
+//------------------------------------------------------------------------------
+class SineLFO {
+  private:
+    static constexpr size_t LANES = 8;
+
+    double cycles;     // LFO cycles per frame
+    double rotCos, rotSin; // rotation by LANES frames
+    size_t n = 0;      // frames generated so far
+
+  public:
+    SineLFO(double freq, int samplerate)
+        : cycles(freq / samplerate), rotCos(cos(2 * M_PI * cycles * LANES)), rotSin(sin(2 * M_PI * cycles * LANES)) {}
+
+    void generate(double* out, size_t frames) {
+        double s[LANES], c[LANES];
+        for(size_t j = 0; j < LANES; j++) {
+            double phase = 2 * M_PI * fmod(cycles * static_cast<double>(n + j), 1.0);
+            s[j] = sin(phase);
+            c[j] = cos(phase);
+        }
+        size_t i = 0;
+        for(; i + LANES <= frames; i += LANES) {
+            for(size_t j = 0; j < LANES; j++) {
+                out[i + j] = s[j];
+                double sj = s[j] * rotCos + c[j] * rotSin;
+                c[j] = c[j] * rotCos - s[j] * rotSin;
+                s[j] = sj;
+            }
+        }
+        for(size_t j = 0; i < frames; i++, j++)
+            out[i] = s[j];
+        n += frames;
+    }
+};
+
+//------------------------------------------------------------------------------
+// Tremolo (Amplitude modulation)
+//------------------------------------------------------------------------------
+class AmplitudeMod : public Effect {
+  private:
+    static constexpr size_t SUB_BLOCK = 4096;
+
+    int channels;
+    double depth;
+    SineLFO lfo;
+    std::vector<double> mod; // per frame
+    std::vector<float> gain; // per sample (mod repeated for every channel)
+
+  public:
+    AmplitudeMod(int channels, int samplerate, double freq, double depth)
+        : channels(channels), depth(depth), lfo(freq, samplerate), mod(SUB_BLOCK), gain(SUB_BLOCK * channels) {}
+
+    void process(float* samples, size_t frames) override {
+        while(frames > 0) {
+            size_t n = std::min(frames, SUB_BLOCK);
+            lfo.generate(mod.data(), n);
+            for(size_t i = 0; i < n; i++)
+                for(int c = 0; c < channels; c++)
+                    gain[i * channels + c] = static_cast<float>(1.0 + depth * mod[i]);
+
+            for(size_t j = 0; j < n * channels; j++)
+                samples[j] *= gain[j];
+
+            samples += n * channels;
+            frames -= n;
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Vibrato (Time-varying delay), with linear interpolation between the two
+// frames around the (fractional) delay
+//------------------------------------------------------------------------------
+class TimeVaryingDelay : public Effect {
+  private:
+    static constexpr size_t SUB_BLOCK = 4096;
+
+    int channels;
+    size_t maxDelaySamples;
+    DelayLine line;
+    SineLFO lfo;
+    std::vector<double> mod;
+    size_t n = 0; // frames processed so far
+
+  public:
+    TimeVaryingDelay(int channels, int samplerate, double maxDelaySec, double freq)
+        : channels(channels), maxDelaySamples(static_cast<size_t>(maxDelaySec * samplerate)),
+          line(maxDelaySamples + 1, channels), lfo(freq, samplerate), mod(SUB_BLOCK) {}
+
+    void process(float* samples, size_t frames) override {
+        while(frames > 0) {
+            size_t len = std::min(frames, SUB_BLOCK);
+            lfo.generate(mod.data(), len);
+            for(size_t i = 0; i < len; i++, n++) {
+                float* frame = samples + i * channels;
+                line.push(frame);
+                if(n < maxDelaySamples)
+                    continue;
+
+                double delaySamples = maxDelaySamples * (0.5 + 0.5 * mod[i]);
+                size_t d0 = std::min(static_cast<size_t>(delaySamples), maxDelaySamples);
+                float frac = static_cast<float>(delaySamples - d0);
+                const float* a = line.tap(d0);
+                const float* b = line.tap(d0 + 1);
+                for(int c = 0; c < channels; c++)
+                    frame[c] = a[c] + frac * (b[c] - a[c]);
+            }
+            samples += len * channels;
+            frames -= len;
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Convolution reverb: y = (1 - mix) * x + mix * (x * h), with h an impulse
+// response (mono, or one per channel), by uniformly partitioned overlap-save
+// FFT convolution. h is cut into K partitions of P frames, whose spectra (FFT
+// size 2P) are computed once; the spectra of the last K input partitions are
+// kept in a frequency-domain delay line, so each partition of output costs two
+// FFTs and K spectrum products per channel, whatever the length of h.
+// The output is not delayed: the sum over the K - 1 older input partitions is
+// fixed for a whole partition and computed once when the previous one is
+// complete, and the product of the (possibly partial) current partition with
+// the first IR partition is recomputed for every call.
+//------------------------------------------------------------------------------
+class ConvolutionReverb : public Effect {
+  private:
+    static constexpr size_t MAX_PARTITION = 1024;
+
+    int channels;
+    int irChannels;
+    float mix;
+    size_t P;              // partition length (frames)
+    size_t K;              // number of partitions
+    size_t bins;           // P + 1 spectrum bins (re, im interleaved below)
+    std::vector<double> H; // IR spectra, [irChannel][partition][bin]
+    std::vector<double> X; // input spectra, [channel][slot][bin], slot ring
+    std::vector<double> T; // sum of the older partitions, [channel][bin]
+    std::vector<double> in; // [channel][previous partition | current partition]
+    size_t head = 0;       // slot of the current input partition
+    size_t fill = 0;       // frames in the current partition
+
+    double* time;          // FFT work buffers
+    fftw_complex* spec;
+    fftw_plan forward, inverse;
+
+    // T = sum_{j=1..K-1} X[slot of partition (current + 1 - j)] * H[j], i.e.
+    // the output of the next partition due to the inputs received so far
+    void tail_sum(int c) {
+        const double* h = &H[(irChannels == 1 ? 0 : c) * K * bins * 2];
+        const double* x = &X[c * K * bins * 2];
+        double* t = &T[c * bins * 2];
+        std::fill(t, t + bins * 2, 0.0);
+        for(size_t j = 1; j < K; j++) {
+            const double* xj = x + ((head + 1 + K - j) % K) * bins * 2;
+            const double* hj = h + j * bins * 2;
+            for(size_t b = 0; b < bins * 2; b += 2) {
+                t[b] += xj[b] * hj[b] - xj[b + 1] * hj[b + 1];
+                t[b + 1] += xj[b] * hj[b + 1] + xj[b + 1] * hj[b];
+            }
+        }
+    }
+
+  public:
+    // ir: interleaved, irChannels is 1 or channels; full scale is 1.0
+    ConvolutionReverb(int channels, const std::vector<float>& ir, int irChannels, double mix)
+        : channels(channels), irChannels(irChannels), mix(static_cast<float>(mix)) {
+        size_t irFrames = std::max<size_t>(1, ir.size() / irChannels);
+        P = 1;
+        while(P < irFrames && P < MAX_PARTITION)
+            P <<= 1;
+        K = (irFrames + P - 1) / P;
+        bins = P + 1;
+
+        time = fftw_alloc_real(2 * P);
+        spec = fftw_alloc_complex(bins);
+        {
+            std::lock_guard<std::mutex> lk(fftw_planner_mutex());
+            forward = fftw_plan_dft_r2c_1d(static_cast<int>(2 * P), time, spec, FFTW_ESTIMATE);
+            inverse = fftw_plan_dft_c2r_1d(static_cast<int>(2 * P), spec, time, FFTW_ESTIMATE);
+        }
+
+        // Spectra of the zero-padded IR partitions, with the 1 / 2P of the
+        // inverse transform folded in
+        H.assign(irChannels * K * bins * 2, 0.0);
+        const double scale = 1.0 / (2.0 * P);
+        for(int c = 0; c < irChannels; c++)
+            for(size_t j = 0; j < K; j++) {
+                std::fill(time, time + 2 * P, 0.0);
+                for(size_t i = 0; i < P && j * P + i < irFrames; i++)
+                    time[i] = ir[(j * P + i) * irChannels + c] * scale;
+                fftw_execute(forward);
+                std::copy(&spec[0][0], &spec[0][0] + bins * 2, &H[(c * K + j) * bins * 2]);
+            }
+
+        X.assign(channels * K * bins * 2, 0.0);
+        T.assign(channels * bins * 2, 0.0);
+        in.assign(channels * 2 * P, 0.0);
+    }
+
+    ConvolutionReverb(const ConvolutionReverb&) = delete;
+    ConvolutionReverb& operator=(const ConvolutionReverb&) = delete;
+
+    ~ConvolutionReverb() override {
+        std::lock_guard<std::mutex> lk(fftw_planner_mutex());
+        fftw_destroy_plan(forward);
+        fftw_destroy_plan(inverse);
+        fftw_free(time);
+        fftw_free(spec);
+    }
+
+    void process(float* samples, size_t frames) override {
+        while(frames > 0) {
+            size_t n = std::min(frames, P - fill);
+            for(int c = 0; c < channels; c++) {
+                double* buf = &in[c * 2 * P];
+                for(size_t i = 0; i < n; i++)
+                    buf[P + fill + i] = samples[i * channels + c];
+
+                // Spectrum of [previous | current, zero padded], kept in the delay line
+                std::copy(buf, buf + 2 * P, time);
+                fftw_execute(forward);
+                double* xs = &X[(c * K + head) * bins * 2];
+                std::copy(&spec[0][0], &spec[0][0] + bins * 2, xs);
+
+                // Y = X * H[0] + T
+                const double* h0 = &H[(irChannels == 1 ? 0 : c) * K * bins * 2];
+                const double* t = &T[c * bins * 2];
+                for(size_t b = 0; b < bins; b++) {
+                    double re = xs[2 * b], im = xs[2 * b + 1];
+                    spec[b][0] = re * h0[2 * b] - im * h0[2 * b + 1] + t[2 * b];
+                    spec[b][1] = re * h0[2 * b + 1] + im * h0[2 * b] + t[2 * b + 1];
+                }
+                fftw_execute(inverse);
+
+                // Overlap-save: the second half is the linear convolution
+                for(size_t i = 0; i < n; i++) {
+                    float& s = samples[i * channels + c];
+                    s = (1.0f - mix) * s + mix * static_cast<float>(time[P + fill + i]);
+                }
+            }
+            fill += n;
+
+            if(fill == P) {
+                for(int c = 0; c < channels; c++) {
+                    tail_sum(c);
+                    double* buf = &in[c * 2 * P];
+                    std::copy(buf + P, buf + 2 * P, buf);
+                    std::fill(buf + P, buf + 2 * P, 0.0);
+                }
+                head = (head + 1) % K;
+                fill = 0;
+            }
+            samples += n * channels;
+            frames -= n;
+        }
+    }
+};
+
+#endif
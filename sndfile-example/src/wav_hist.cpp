@@ -17,17 +17,162 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <fstream>
+#include <cmath>
+#include <thread>
 #include <sndfile.hh>
 #include "wav_hist.h"
+#include "batch.h"
+#include "audio_io.h"
 
 using namespace std;
 
 constexpr size_t FRAMES_BUFFER_SIZE = 65536; // Buffer for reading frames
 
+// Entropy report: zeroth-order entropy of the histogram and after uniform
+// quantization to each bit depth (up to "maxBits", the bits of the file), with
+// the size an ideal entropy coder would reach compared to the fixed-rate QNT
+// payload
+template <typename T>
+static void report_entropy(const map<T, size_t>& counts, int maxBits) {
+    using Hist = BasicWAVHist<T>;
+    size_t n = Hist::total(counts);
+    cout << "Samples: " << n << "\n";
+    cout << "Entropy: " << Hist::entropy(counts) << " bits/sample\n";
+    cout << "bits\tH (bits/sample)\tentropy-coded (bytes)\tQNT payload (bytes)\n";
+    for(int bits = maxBits; bits >= 1; bits--) {
+        double h = Hist::quantizedEntropy(counts, bits, maxBits);
+        cout << bits << '\t' << h << '\t' << static_cast<size_t>(ceil(h * n / 8))
+             << '\t' << (n * bits + 7) / 8 << '\n';
+    }
+}
+
+// Batch job: binary histogram (as with -w) of job.input into job.output;
+// "buffers" are the read buffers of the worker, reused across files
+template <typename T>
+static void hist_file(const BatchJob& job, SndfileHandle& sndFile, size_t bin_size, BasicReaderBuffers<T>& buffers, BatchResult& result) {
+    BasicWAVHist<T> hist { sndFile, bin_size };
+    result.samplerate = sndFile.samplerate();
+    BasicBlockReader<T> reader { sndFile, FRAMES_BUFFER_SIZE, &buffers };
+    T* samples;
+    size_t nFrames;
+    while((nFrames = reader.next(samples))) {
+        size_t count = nFrames * reader.channels();
+        hist.update(samples, count);
+        hist.updateMid(samples, count);
+        hist.updateSide(samples, count);
+        result.frames += nFrames;
+    }
+
+    ofstream out(job.output, ios::binary | ios::trunc);
+    hist.save(out);
+    if(!out)
+        result.error = "cannot write histogram file";
+}
+
+static void hist_file(const BatchJob& job, size_t bin_size, AnyReaderBuffers& buffers, BatchResult& result) {
+    SndfileHandle sndFile { job.input };
+    result.error = check_wav(sndFile);
+    if(!result.error.empty())
+        return;
+    if(sample_type(sndFile) == SampleType::Float) {
+        result.error = "binary histograms need integer samples";
+        return;
+    }
+
+    if(sample_type(sndFile) == SampleType::Int)
+        hist_file<int>(job, sndFile, bin_size, buffers.get<int>(), result);
+    else
+        hist_file<short>(job, sndFile, bin_size, buffers.get<short>(), result);
+}
+
+// Builds the histogram(s) of one file and prints or writes them, in the native
+// sample type T of the file
+template <typename T>
+static int hist_stream(SndfileHandle& sndFile, const string& histFile, bool report, bool dumpMid, bool dumpSide,
+                       int channel, size_t bin_size) {
+    size_t nFrames;
+    T* samples;
+    BasicWAVHist<T> hist { sndFile, bin_size };
+    BasicBlockReader<T> reader { sndFile, FRAMES_BUFFER_SIZE };
+
+    while((nFrames = reader.next(samples))) {
+        size_t count = nFrames * reader.channels();
+        if(!histFile.empty()) {
+            hist.update(samples, count); // everything goes into the binary file
+            hist.updateMid(samples, count);
+            hist.updateSide(samples, count);
+        } else if(dumpMid) {
+        	hist.updateMid(samples, count);
+		} else if(dumpSide) {
+			hist.updateSide(samples, count);
+		} else {
+			hist.update(samples, count); // per-channel
+		}
+    }
+
+    if constexpr (SampleTraits<T>::IS_INTEGER) {
+        if(!histFile.empty()) {
+            ofstream out(histFile, ios::binary | ios::trunc);
+            hist.save(out);
+            if(!out) {
+                cerr << "Error: cannot write histogram file\n";
+                return 1;
+            }
+        }
+    }
+
+    // output histogram
+    if(report) {
+        report_entropy(dumpMid ? hist.getMidCounts() : dumpSide ? hist.getSideCounts() : hist.getChannelCounts(channel),
+                       sample_bits(sndFile.format()));
+    } else if(dumpMid) {
+        hist.dumpMid();
+    } else if(dumpSide) {
+        hist.dumpSide();
+    } else {
+        hist.dump(channel);
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
 
+    // optional binary histogram output (all channels + mid + side)
+    string histFile;
+    bool report = false;
+    string batchFile;
+    unsigned nThreads = max(1u, thread::hardware_concurrency());
+    vector<char*> args { argv[0] };
+    for(int n = 1 ; n < argc ; n++) {
+        if(string(argv[n]) == "-w" && n + 1 < argc)
+            histFile = argv[++n];
+        else if(string(argv[n]) == "-e")
+            report = true; // entropy report instead of histogram dump
+        else if(string(argv[n]) == "-batch" && n + 1 < argc)
+            batchFile = argv[++n];
+        else if(string(argv[n]) == "-j" && n + 1 < argc)
+            nThreads = static_cast<unsigned>(max(1, atoi(argv[++n])));
+        else
+            args.push_back(argv[n]);
+    }
+    argc = static_cast<int>(args.size());
+    argv = args.data();
+
+    // batch: one binary histogram per 'input histFile' line of the list
+    if(!batchFile.empty()) {
+        size_t bin_size = argc >= 2 ? static_cast<size_t>(max(1, atoi(argv[1]))) : 1;
+        vector<AnyReaderBuffers> buffers(nThreads); // one per worker
+        return batch_main(batchFile, nThreads, [&](const BatchJob& job, unsigned worker, BatchResult& result) {
+            hist_file(job, bin_size, buffers[worker], result);
+        });
+    }
+
     if(argc < 3) {
-        cerr << "Usage: " << argv[0] << " <input file> <channel|mid|side> [bin_size]\n";
+        cerr << "Usage: " << argv[0] << " [ -e ] [ -w histFile ] <input file> <channel|mid|side> [bin_size]\n";
+        cerr << "       " << argv[0] << " [ -j threads ] -batch list.txt [bin_size]\n";
+        cerr << "  list.txt: one 'input.wav histFile' pair per line (binary histograms, as -w)\n";
         return 1;
     }
 
@@ -39,18 +184,13 @@ int main(int argc, char *argv[]) {
 
     // open input WAV
     SndfileHandle sndFile { argv[1] };
-    if(sndFile.error()) {
-        cerr << "Error: invalid input file\n";
+    string error = check_wav(sndFile);
+    if(!error.empty()) {
+        cerr << "Error: " << error << "\n";
         return 1;
     }
-
-    if((sndFile.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV) {
-        cerr << "Error: file is not in WAV format\n";
-        return 1;
-    }
-
-    if((sndFile.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16) {
-        cerr << "Error: file is not in PCM_16 format\n";
+    if(!histFile.empty() && sample_type(sndFile) == SampleType::Float) {
+        cerr << "Error: binary histograms need integer samples\n";
         return 1;
     }
 
@@ -92,29 +232,7 @@ int main(int argc, char *argv[]) {
     }
 
     // build histogram
-    size_t nFrames;
-    vector<short> samples(FRAMES_BUFFER_SIZE * sndFile.channels());
-    WAVHist hist { sndFile, bin_size };
-
-    while((nFrames = sndFile.readf(samples.data(), FRAMES_BUFFER_SIZE))) {
-        samples.resize(nFrames * sndFile.channels());
-      	if(dumpMid) {
-        	hist.updateMid(samples);
-		} else if(dumpSide) {
-			hist.updateSide(samples);
-		} else {
-			hist.update(samples); // per-channel
-		}
-    }
-
-    // output histogram
-    if(dumpMid) {
-        hist.dumpMid();
-    } else if(dumpSide) {
-        hist.dumpSide();
-    } else {
-        hist.dump(channel);
-    }
-
-    return 0;
+    return with_sample_type(sample_type(sndFile), [&](auto zero) {
+        return hist_stream<decltype(zero)>(sndFile, histFile, report, dumpMid, dumpSide, channel, bin_size);
+    });
 }
@@ -20,92 +20,335 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <type_traits>
 #include <sndfile.hh>
+#include "wav_quant.h"
+#include "audio_io.h" // SampleType
 
-class WAVHist {
+//------------------------------------------------------------------------------
+// Histograms of the native sample values of a file (see sample_traits.h), per
+// channel and, for stereo, of MID and SIDE. Left-justified int samples are
+// counted at the resolution of the file (24-bit values for PCM_24); float
+// samples on the grid of a 24-bit mantissa, so bins are bin_size * 2^-23 wide.
+//------------------------------------------------------------------------------
+template <typename T>
+class BasicWAVHist {
   private:
-	std::vector<std::map<short, size_t>> counts; // Array of maps <sample value, count> - one per channel
+	using Wide = typename SampleTraits<T>::Wide;
+	static constexpr double FLOAT_GRID = 8388608.0; // 2^23 bins per unit
+
+	std::vector<std::map<T, size_t>> counts; // Array of maps <sample value, count> - one per channel
 	// counts[0][100] --> number of times Left channel saw sample 100 --> 2
 	// counts[1][-50] --> number of times Right channel saw sample -50 --> 5
 	
-	std::map<short, size_t> mid_counts;   // histogram for MID channel  - only one channel
+	std::map<T, size_t> mid_counts;   // histogram for MID channel  - only one channel
 	// mid_counts[0] --> number of times MID channel saw sample 0 --> 10
 
-	std::map<short, size_t> side_counts;  // histogram for SIDE channel - only one channel
+	std::map<T, size_t> side_counts;  // histogram for SIDE channel - only one channel
 	// side_counts[0] --> number of times SIDE channel saw sample 0 --> 15
+
+	int shift = 0; // int samples: 32 - bits of the file
+	int value_bits = 0; // resolution of the values (16, or the bits of the file for int); 0: not set yet
+
+	// Sample type of the values in "WHS2" headers
+	static constexpr uint64_t TYPE_CODE = std::is_same_v<T, int> ? 1 : 0;
+
+	T native(T value) const {
+		if constexpr (std::is_same_v<T, int>)
+			return value >> shift;
+		else
+			return value;
+	}
   
-	short quantize(short value) const {
-		if (bin_size <= 1) return value;
+	T quantize(T value) const {
+		if constexpr (SampleTraits<T>::IS_INTEGER) {
+			if (bin_size <= 1) return value;
+
+			Wide val = static_cast<Wide>(value);
+			Wide bin = static_cast<Wide>(bin_size); // ensure bin_size is signed
 
-		int val = static_cast<int>(value);
-		int bin = bin_size; // ensure bin_size is int
+			Wide q = (val / bin) * bin;           // trunc toward zero result
+			if (val < 0 && (val % bin) != 0) {    // for negatives with remainder, move down one bin
+				q -= bin;
+			}
 
-		int q = (val / bin) * bin;            // trunc toward zero result
-		if (val < 0 && (val % bin) != 0) {    // for negatives with remainder, move down one bin
-			q -= bin;
+			return static_cast<T>(q);
+		} else {
+			double bin = static_cast<double>(bin_size);
+			return static_cast<T>(std::floor(value * FLOAT_GRID / bin) * bin / FLOAT_GRID);
 		}
+	}
+
+	// Binary histogram files ("WHS2") store every number as an unsigned LEB128
+	// varint; sample values are delta coded (zigzag) along the sorted map keys
+	static void write_varint(std::ostream& os, uint64_t v) {
+		while(v >= 0x80) {
+			os.put(static_cast<char>((v & 0x7F) | 0x80));
+			v >>= 7;
+		}
+		os.put(static_cast<char>(v));
+	}
 
-		return static_cast<short>(q);
+	static bool read_varint(std::istream& is, uint64_t& v) {
+		v = 0;
+		for(int shift = 0; shift < 64; shift += 7) {
+			int c = is.get();
+			if(c == EOF) return false;
+			v |= static_cast<uint64_t>(c & 0x7F) << shift;
+			if(!(c & 0x80)) return true;
+		}
+		return false;
+	}
+
+	static void write_counts(std::ostream& os, const std::map<T, size_t>& m) {
+		write_varint(os, m.size());
+		int64_t prev = 0;
+		for(auto [value, counter] : m) {
+			int64_t delta = static_cast<int64_t>(value) - prev;
+			write_varint(os, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63)); // zigzag
+			write_varint(os, counter);
+			prev = value;
+		}
+	}
+
+	static bool read_counts(std::istream& is, std::map<T, size_t>& m) {
+		uint64_t n, zz, counter;
+		if(!read_varint(is, n) || n > (uint64_t(1) << SampleTraits<T>::BITS)) return false;
+		int64_t prev = 0;
+		m.clear();
+		for(uint64_t i = 0; i < n; i++) {
+			if(!read_varint(is, zz) || !read_varint(is, counter)) return false;
+			int64_t value = prev + (static_cast<int64_t>(zz >> 1) ^ -static_cast<int64_t>(zz & 1));
+			if(value < SampleTraits<T>::MIN || value > SampleTraits<T>::MAX) return false;
+			m[static_cast<T>(value)] = counter;
+			prev = value;
+		}
+		return true;
+	}
+
+	static void add_counts(std::map<T, size_t>& dst, const std::map<T, size_t>& src) {
+		for(auto [value, counter] : src)
+			dst[value] += counter;
+	}
+
+	static void print_counts(const std::map<T, size_t>& m) {
+		std::streamsize precision = std::cout.precision(std::numeric_limits<T>::max_digits10);
+		for (auto [value, counter] : m)
+			std::cout << value << '\t' << counter << '\n';
+		std::cout.precision(precision);
 	}
 
 
 public:
     size_t bin_size;
 
-    WAVHist(const SndfileHandle& sfh, size_t bin_size = 1)
+    BasicWAVHist(const SndfileHandle& sfh, size_t bin_size = 1)
         : bin_size(bin_size) {
         counts.resize(sfh.channels());
+        value_bits = SampleTraits<T>::BITS;
+        if constexpr (std::is_same_v<T, int>) {
+            value_bits = sample_bits(sfh.format());
+            shift = 32 - value_bits;
+        }
     }
 
-    void update(const std::vector<short>& samples) {
-        size_t n{};
-        for (auto s : samples)
-            counts[n++ % counts.size()][quantize(s)]++;
+    // Empty histogram, e.g. to be filled by load() or merge()
+    explicit BasicWAVHist(size_t nChannels = 0, size_t bin_size = 1)
+        : bin_size(bin_size) {
+        counts.resize(nChannels);
+    }
+
+    // "count" interleaved samples, starting with channel 0
+    void update(const T* samples, size_t count) {
+        for (size_t n = 0; n < count; n++)
+            counts[n % counts.size()][quantize(native(samples[n]))]++;
     }
 
-    void updateMid(const std::vector<short>& samples) {
+    void update(const std::vector<T>& samples) {
+        update(samples.data(), samples.size());
+    }
+
+    void updateMid(const T* samples, size_t count) {
         if (counts.size() != 2)
             return; // Only for stereo
 
-        for (size_t i = 0; i + 1 < samples.size(); i += 2) {
-            short L = samples[i];
-            short R = samples[i + 1];
-            int mid = (static_cast<int>(L) + static_cast<int>(R)) / 2;
-            mid_counts[quantize(static_cast<short>(mid))]++;
+        for (size_t i = 0; i + 1 < count; i += 2) {
+            Wide L = native(samples[i]);
+            Wide R = native(samples[i + 1]);
+            Wide mid = (L + R) / 2;
+            mid_counts[quantize(static_cast<T>(mid))]++;
         }
     }
 
-    void updateSide(const std::vector<short>& samples) {
+    void updateMid(const std::vector<T>& samples) {
+        updateMid(samples.data(), samples.size());
+    }
+
+    void updateSide(const T* samples, size_t count) {
         if (counts.size() != 2)
             return; // Only valid for stereo
 
-        for (size_t i = 0; i + 1 < samples.size(); i += 2) {
-            short L = samples[i];
-            short R = samples[i + 1];
-            int side = (static_cast<int>(L) - static_cast<int>(R)) / 2;
-            side_counts[quantize(static_cast<short>(side))]++;
+        for (size_t i = 0; i + 1 < count; i += 2) {
+            Wide L = native(samples[i]);
+            Wide R = native(samples[i + 1]);
+            Wide side = (L - R) / 2;
+            side_counts[quantize(static_cast<T>(side))]++;
         }
     }
 
+    void updateSide(const std::vector<T>& samples) {
+        updateSide(samples.data(), samples.size());
+    }
+
     void dump(const size_t channel) const {
-        for (auto [value, counter] : counts[channel])
-            std::cout << value << '\t' << counter << '\n';
+        print_counts(counts[channel]);
     }
 
     void dumpMid() const {
-        for (auto [value, counter] : mid_counts)
-            std::cout << value << '\t' << counter << '\n';
+        print_counts(mid_counts);
     }
 
     void dumpSide() const {
-        for (auto [value, counter] : side_counts)
-            std::cout << value << '\t' << counter << '\n';
+        print_counts(side_counts);
     }
 
-    const std::map<short, size_t>& getChannelCounts(size_t ch) const {
+    const std::map<T, size_t>& getChannelCounts(size_t ch) const {
         return counts[ch];
     }
 
+    const std::map<T, size_t>& getMidCounts() const {
+        return mid_counts;
+    }
+
+    const std::map<T, size_t>& getSideCounts() const {
+        return side_counts;
+    }
+
+    size_t channels() const {
+        return counts.size();
+    }
+
+    int bits() const {
+        return value_bits;
+    }
+
+    static size_t total(const std::map<T, size_t>& m) {
+        size_t n = 0;
+        for(auto [value, counter] : m)
+            n += counter;
+        return n;
+    }
+
+    // Zeroth-order entropy (bits per sample) of a histogram
+    static double entropy(const std::map<T, size_t>& m) {
+        double n = static_cast<double>(total(m));
+        double h = 0.0;
+        for(auto [value, counter] : m) {
+            if(counter == 0) continue;
+            double p = counter / n;
+            h -= p * std::log2(p);
+        }
+        return h;
+    }
+
+    // Entropy of the samples after uniform quantization to "bits" bits, as done
+    // by wav_quant/wav_quant_enc; exact when bin_size == 1 (otherwise each bin
+    // is represented by its lower edge). valueBits: resolution of the int
+    // values (bits of the file).
+    static double quantizedEntropy(const std::map<T, size_t>& m, int bits, int valueBits = SampleTraits<T>::BITS) {
+        std::map<T, size_t> q;
+        for(auto [value, counter] : m) {
+            if constexpr (std::is_same_v<T, int>) {
+                const int s = SampleTraits<int>::BITS - valueBits;
+                q[quantize_sample(static_cast<int>(static_cast<uint32_t>(value) << s), bits) >> s] += counter;
+            } else {
+                q[quantize_sample(value, bits)] += counter;
+            }
+        }
+        return entropy(q);
+    }
+
+    // Writes all per-channel, MID and SIDE counts in the binary "WHS2" format:
+    // the sample type of the values (0: short, 1: int) and their resolution
+    // in bits, then the bin size, the channels and the counts (integer
+    // samples only)
+    void save(std::ostream& os) const requires SampleTraits<T>::IS_INTEGER {
+        os.write("WHS2", 4);
+        write_varint(os, TYPE_CODE);
+        write_varint(os, static_cast<uint64_t>(value_bits));
+        write_varint(os, bin_size);
+        write_varint(os, counts.size());
+        for(const auto& m : counts)
+            write_counts(os, m);
+        write_counts(os, mid_counts);
+        write_counts(os, side_counts);
+    }
+
+    // Sample type of the values of a "WHS2" (or older "WHS1", always 16-bit)
+    // stream, from its header; the stream is rewound. False if it is not a
+    // histogram
+    static bool peek_type(std::istream& is, SampleType& type) {
+        char magic[4];
+        uint64_t code = 0;
+        bool ok = is.read(magic, 4) && (std::string(magic, 4) == "WHS1" ||
+                                        (std::string(magic, 4) == "WHS2" && read_varint(is, code) && code <= 1));
+        is.clear();
+        is.seekg(0);
+        type = code ? SampleType::Int : SampleType::Short;
+        return ok;
+    }
+
+    // Replaces the histogram with the contents of a "WHS2" or "WHS1" stream;
+    // false if it is not a histogram of values of type T
+    bool load(std::istream& is) requires SampleTraits<T>::IS_INTEGER {
+        char magic[4];
+        uint64_t code = 0, vb = 16, bs, nChannels;
+        if(!is.read(magic, 4))
+            return false;
+        if(std::string(magic, 4) == "WHS2") {
+            if(!read_varint(is, code) || !read_varint(is, vb))
+                return false;
+        } else if(std::string(magic, 4) != "WHS1")
+            return false;
+        if(code != TYPE_CODE || vb > SampleTraits<T>::BITS || (TYPE_CODE == 0 ? vb != 16 : vb <= 16))
+            return false;
+        if(!read_varint(is, bs) || bs < 1 || !read_varint(is, nChannels) || nChannels > 65535)
+            return false;
+
+        value_bits = static_cast<int>(vb);
+        bin_size = bs;
+        counts.assign(nChannels, {});
+        for(auto& m : counts)
+            if(!read_counts(is, m))
+                return false;
+        return read_counts(is, mid_counts) && read_counts(is, side_counts);
+    }
+
+    // Adds the counts of another histogram of values of the same resolution;
+    // an empty histogram (no channels) takes the layout of the first one
+    // merged into it
+    bool merge(const BasicWAVHist& other) {
+        if(counts.empty()) {
+            counts.resize(other.counts.size());
+            bin_size = other.bin_size;
+            value_bits = other.value_bits;
+        }
+        if(counts.size() != other.counts.size() || bin_size != other.bin_size || value_bits != other.value_bits)
+            return false;
+
+        for(size_t c = 0; c < counts.size(); c++)
+            add_counts(counts[c], other.counts[c]);
+        add_counts(mid_counts, other.mid_counts);
+        add_counts(side_counts, other.side_counts);
+        return true;
+    }
+
 };
 
-#endif
\ No newline at end of file
+using WAVHist = BasicWAVHist<short>;
+
+#endif
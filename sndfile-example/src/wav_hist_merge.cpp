@@ -0,0 +1,136 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include "wav_hist.h"
+#include "audio_io.h"
+
+using namespace std;
+
+// Sums the histograms of files[next..] into acc; files are claimed one at a time
+// so that workers stay busy even when file sizes differ
+template <typename T>
+static void merge_worker(const vector<string> &files, atomic<size_t> &next, BasicWAVHist<T> &acc, string &error) {
+    size_t i;
+    while(error.empty() && (i = next++) < files.size()){
+        ifstream in(files[i], ios::binary);
+        SampleType type;
+        if(!in || !BasicWAVHist<T>::peek_type(in, type)){
+            error = "cannot read histogram file " + files[i];
+            return;
+        }
+        BasicWAVHist<T> h;
+        if(type != (is_same_v<T, int> ? SampleType::Int : SampleType::Short)){
+            error = "incompatible histogram (sample type) in " + files[i];
+            return;
+        }
+        if(!h.load(in)){
+            error = "cannot read histogram file " + files[i];
+            return;
+        }
+        if(!acc.merge(h)){
+            error = "incompatible histogram (channels, bin size or bits) in " + files[i];
+            return;
+        }
+    }
+}
+
+// Merges the files (values of type T) into outFile and dumps the result
+template <typename T>
+static int merge_files(const vector<string> &files, unsigned nThreads, const string &outFile, const string &dumpArg) {
+    // Each worker merges into its own histogram; partial results are reduced at the end
+    vector<BasicWAVHist<T>> partial(nThreads);
+    vector<string> errors(nThreads);
+    atomic<size_t> next { 0 };
+    vector<thread> workers;
+    for(unsigned t = 0; t < nThreads; ++t){
+        workers.emplace_back(merge_worker<T>, cref(files), ref(next), ref(partial[t]), ref(errors[t]));
+    }
+    for(auto &w : workers){
+        w.join();
+    }
+
+    BasicWAVHist<T> total;
+    for(unsigned t = 0; t < nThreads; ++t){
+        if(!errors[t].empty()){
+            cerr << "Error: " << errors[t] << "\n";
+            return 1;
+        }
+        if(partial[t].channels() > 0 && !total.merge(partial[t])){
+            cerr << "Error: incompatible histograms (channels, bin size or bits)\n";
+            return 1;
+        }
+    }
+
+    ofstream out(outFile, ios::binary | ios::trunc);
+    total.save(out);
+    if(!out){
+        cerr << "Error: cannot write histogram file\n";
+        return 1;
+    }
+
+    // optional text dump, same layout as wav_hist
+    if(dumpArg == "mid"){
+        total.dumpMid();
+    }else if(dumpArg == "side"){
+        total.dumpSide();
+    }else if(!dumpArg.empty()){
+        size_t channel = 0;
+        try {
+            channel = static_cast<size_t>(stoi(dumpArg));
+        } catch(...) {
+            channel = total.channels();
+        }
+        if(channel >= total.channels()){
+            cerr << "Error: invalid channel requested\n";
+            return 1;
+        }
+        total.dump(channel);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned nThreads = max(1u, thread::hardware_concurrency());
+    string dumpArg;
+    vector<string> files;
+
+    for(int n = 1; n < argc; ++n){
+        string arg = argv[n];
+        if(arg == "-j" && n + 1 < argc){
+            nThreads = static_cast<unsigned>(max(1, atoi(argv[++n])));
+        }else if(arg == "-d" && n + 1 < argc){
+            dumpArg = argv[++n];
+        }else{
+            files.push_back(arg);
+        }
+    }
+
+    if(files.size() < 2){
+        cerr << "Usage: wav_hist_merge [ -j threads ] [ -d channel|mid|side ] histFileOut histFileIn...\n";
+        cerr << "  Sums binary histograms written by 'wav_hist -w' (all of the same sample type and bits).\n";
+        return 1;
+    }
+
+    string outFile = files.front();
+    files.erase(files.begin());
+    nThreads = static_cast<unsigned>(min<size_t>(nThreads, files.size()));
+
+    // The first file decides the sample type; the others must match it
+    ifstream first(files.front(), ios::binary);
+    SampleType type;
+    if(!first || !WAVHist::peek_type(first, type)){
+        cerr << "Error: cannot read histogram file " << files.front() << "\n";
+        return 1;
+    }
+    return with_sample_type(type, [&](auto zero) {
+        using T = decltype(zero);
+        if constexpr (SampleTraits<T>::IS_INTEGER)
+            return merge_files<T>(files, nThreads, outFile, dumpArg);
+        else
+            return 1; // binary histograms are never float
+    });
+}
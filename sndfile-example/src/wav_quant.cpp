@@ -1,31 +1,44 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <sndfile.hh>
+#include "wav_quant.h"
+#include "audio_io.h"
 
 using namespace std;
 
 constexpr size_t FRAMES_BUFFER_SIZE = 65536;
 
-static inline short quantize_sample(short s, int bits) {
-    if(bits >= 16) return s;
-    const int step = 1 << (16 - bits);
-    int x = static_cast<int>(s);
-    // Round to nearest multiple of step (symmetric rounding around 0)
-    int q = ((x + (x >= 0 ? step/2 : -step/2)) / step) * step;
-    // Clamp to 16-bit range just in case
-    if(q > 32767) q = 32767;
-    if(q < -32768) q = -32768;
-    return static_cast<short>(q);
+// Quantizes the whole input, block by block, in its native sample type T
+template <typename T>
+static void quantize_stream(SndfileHandle& sfhIn, SndfileHandle& sfhOut, size_t blockFrames, int bits, BlockLatency& latency) {
+    size_t nFrames;
+    T* samples;
+    BasicBlockReader<T> reader { sfhIn, blockFrames };
+    BlockWriter writer { sfhOut };
+    while((nFrames = reader.next(samples))) {
+        // Quantize all samples in-place
+        latency.start();
+        size_t count = nFrames * reader.channels();
+        quantize_block(samples, samples, count, bits);
+        latency.stop();
+        writer.write(samples, nFrames);
+    }
 }
 
 int main(int argc, char *argv[]) {
     bool verbose { false };
     int bits { -1 };
+    size_t blockFrames { FRAMES_BUFFER_SIZE };
+    StreamFormat streamFmt;
+    bool reportLatency { false };
 
     if(argc < 4) {
-        cerr << "Usage: wav_quant [ -v ] -b bits wavFileIn wavFileOut\n";
-        cerr << "  bits: number of quantization bits (1..16).\n";
+        cerr << "Usage: wav_quant [ -v ] [ -bs frames ] [ -raw channels:samplerate ] [ -lat ] -b bits wavFileIn wavFileOut\n";
+        cerr << "  bits: number of quantization bits (1..16; up to 24 for PCM_24/FLOAT, 32 for PCM_32).\n";
+        cerr << "  '-' as wavFileIn/wavFileOut: stdin/stdout; -raw: headerless PCM_16 streams;\n";
+        cerr << "  -lat: report the worst-case block processing latency.\n";
         return 1;
     }
 
@@ -43,50 +56,67 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if(bits <= 0 || bits > 16) {
-        cerr << "Error: bits must be in 1..16\n";
-        return 1;
+    for(int n = 1 ; n < argc-2 ; n++){
+        if(string(argv[n]) == "-bs") {
+            blockFrames = static_cast<size_t>(max(1, atoi(argv[n+1])));
+            break;
+        }
     }
 
-    SndfileHandle sfhIn { argv[argc-2] };
-    if(sfhIn.error()) {
-        cerr << "Error: invalid input file\n";
-        return 1;
+    for(int n = 1 ; n < argc-2 ; n++){
+        if(string(argv[n]) == "-raw") {
+            if(!streamFmt.parse(argv[n+1])) {
+                cerr << "Error: -raw expects channels:samplerate\n";
+                return 1;
+            }
+            break;
+        }
     }
 
-    if((sfhIn.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV) {
-        cerr << "Error: file is not in WAV format\n";
+    for(int n = 1 ; n < argc-2 ; n++){
+        if(string(argv[n]) == "-lat") {
+            reportLatency = true;
+            break;
+        }
+    }
+
+    SndfileHandle sfhIn = open_input(argv[argc-2], streamFmt);
+    string error = check_wav(sfhIn, true);
+    if(!error.empty()) {
+        cerr << "Error: " << error << "\n";
         return 1;
     }
 
-    if((sfhIn.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16) {
-        cerr << "Error: file is not in PCM_16 format\n";
+    const int maxBits = sample_bits(sfhIn.format());
+    if(bits <= 0 || bits > maxBits) {
+        cerr << "Error: bits must be in 1.." << maxBits << "\n";
         return 1;
     }
 
-    SndfileHandle sfhOut { argv[argc-1], SFM_WRITE, sfhIn.format(), sfhIn.channels(), sfhIn.samplerate() };
+    SndfileHandle sfhOut = open_output(argv[argc-1], streamFmt, sfhIn.format(), sfhIn.channels(), sfhIn.samplerate());
     if(sfhOut.error()) {
         cerr << "Error: invalid output file\n";
         return 1;
     }
 
+    // stdout may be carrying the audio stream
+    ostream& msg = is_stdio(argv[argc-1]) ? cerr : cout;
     if(verbose) {
-        cout << "Input file has:\n";
-        cout << '\t' << sfhIn.frames() << " frames\n";
-        cout << '\t' << sfhIn.samplerate() << " samples per second\n";
-        cout << '\t' << sfhIn.channels() << " channels\n";
-        cout << "Quantizing to " << bits << " bits per sample (uniform).\n";
+        msg << "Input file has:\n";
+        msg << '\t' << sfhIn.frames() << " frames\n";
+        msg << '\t' << sfhIn.samplerate() << " samples per second\n";
+        msg << '\t' << sfhIn.channels() << " channels\n";
+        msg << "Quantizing to " << bits << " bits per sample (uniform).\n";
     }
 
-    size_t nFrames;
-    vector<short> samples(FRAMES_BUFFER_SIZE * sfhIn.channels());
-    while((nFrames = sfhIn.readf(samples.data(), FRAMES_BUFFER_SIZE))) {
-        // Quantize all samples in-place
-        size_t count = nFrames * static_cast<size_t>(sfhIn.channels());
-        for(size_t i = 0; i < count; ++i) {
-            samples[i] = quantize_sample(samples[i], bits);
-        }
-        sfhOut.writef(samples.data(), nFrames);
+    const int samplerate = sfhIn.samplerate();
+    BlockLatency latency;
+    with_sample_type(sample_type(sfhIn), [&](auto zero) {
+        quantize_stream<decltype(zero)>(sfhIn, sfhOut, blockFrames, bits, latency);
+    });
+
+    if(reportLatency) {
+        latency.report(cerr, blockFrames, samplerate);
     }
 
     return 0;
@@ -0,0 +1,76 @@
+#ifndef WAVQUANT_H
+#define WAVQUANT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include "sample_traits.h"
+
+// Uniform quantization to 2^bits levels. Integer samples keep the "bits" most
+// significant bits of the type they are read as (see sample_traits.h), float
+// samples take the levels -1, -1 + step, ..., 1 - step (step = 2^(1-bits)).
+template <typename T>
+inline T quantize_sample(T s, int bits) {
+    if constexpr (SampleTraits<T>::IS_INTEGER) {
+        using Wide = typename SampleTraits<T>::Wide;
+        constexpr Wide MIN = static_cast<Wide>(SampleTraits<T>::MIN);
+        constexpr Wide MAX = static_cast<Wide>(SampleTraits<T>::MAX);
+        if(bits >= SampleTraits<T>::BITS) return s;
+        const Wide step = Wide(1) << (SampleTraits<T>::BITS - bits);
+        Wide x = static_cast<Wide>(s);
+        // Round to nearest multiple of step (symmetric rounding around 0)
+        Wide q = ((x + (x >= 0 ? step/2 : -step/2)) / step) * step;
+        // Clamp to the sample range just in case
+        if(q > MAX) q = MAX;
+        if(q < MIN) q = MIN;
+        return static_cast<T>(q);
+    } else {
+        const float scale = std::ldexp(1.0f, bits - 1); // levels per unit
+        float x = s * scale;
+        x = x > scale - 1.0f ? scale - 1.0f : x;
+        x = x < -scale ? -scale : x;
+        x = static_cast<float>(static_cast<int32_t>(x + (x >= 0.0f ? 0.5f : -0.5f)));
+        return x / scale;
+    }
+}
+
+// Same result as quantize_sample() for a whole buffer, with the division by
+// the (power of two) step done by shifts so the loop can be vectorized
+template <typename T>
+inline void quantize_block(const T* in, T* out, size_t n, int bits) {
+    if constexpr (SampleTraits<T>::IS_INTEGER) {
+        using Wide = typename SampleTraits<T>::Wide;
+        constexpr Wide MIN = static_cast<Wide>(SampleTraits<T>::MIN);
+        constexpr Wide MAX = static_cast<Wide>(SampleTraits<T>::MAX);
+        if(bits >= SampleTraits<T>::BITS) {
+            for(size_t i = 0; i < n; i++) out[i] = in[i];
+            return;
+        }
+        const int shift = SampleTraits<T>::BITS - bits;
+        const Wide step = Wide(1) << shift;
+        for(size_t i = 0; i < n; i++) {
+            Wide x = in[i];
+            Wide a = x + (x >= 0 ? step/2 : -step/2);
+            Wide q = ((a + (a < 0 ? step - 1 : 0)) >> shift) << shift; // a / step * step, truncating
+            q = q > MAX ? MAX : q;
+            q = q < MIN ? MIN : q;
+            out[i] = static_cast<T>(q);
+        }
+    } else {
+        for(size_t i = 0; i < n; i++)
+            out[i] = quantize_sample(in[i], bits);
+    }
+}
+
+// Index of a quantized sample among the 2^bits levels (as stored in QNT files)
+inline uint16_t sample_to_code(short sample, int bits){
+    int shifted = static_cast<int>(sample) + 32768;
+    return static_cast<uint16_t>(shifted >> (16 - bits));
+}
+
+// Inverse of sample_to_code()
+inline short code_to_sample(uint32_t code, int bits){
+    return static_cast<short>((code << (16 - bits)) - 32768);
+}
+
+#endif
@@ -1,39 +1,97 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <thread>
+#include <chrono>
 #include <sndfile.hh>
 #include "../../bit_stream/src/bit_stream.h"
+#include "lloyd_max.h"
+#include "qnt_codec.h"
+#include "batch.h"
+#include "audio_io.h"
+#include "stats.h"
 
 using namespace std;
 
-constexpr size_t FRAMES_BUFFER_SIZE = 65536;
-
-static inline short quantize_sample(short s, int bits) {
-    if(bits >= 16) return s;
-    const int step = 1 << (16 - bits);
-    int x = static_cast<int>(s);
-    // Round to nearest multiple of step (symmetric rounding around 0)
-    int q = ((x + (x >= 0 ? step/2 : -step/2)) / step) * step;
-    // Clamp to 16-bit range just in case
-    if(q > 32767) q = 32767;
-    if(q < -32768) q = -32768;
-    return static_cast<short>(q);
-}
+// Encodes one file; "buffers" are reused across the files of a batch,
+// progress messages go to "log" and stage timings to "stats" (none if nullptr).
+// lloydMax: QNT2 file, with a quantizer trained on the file (two passes)
+static void encode_file(const BatchJob& job, int bits, bool lloydMax, ReaderBuffers& buffers, Stats* stats, ostream* log, BatchResult& result) {
+    if(lloydMax && is_stdio(job.input)){
+        result.error = "-lm reads the input twice: it must be a file, not stdin";
+        return;
+    }
+    SndfileHandle sfIn { job.input };
+    result.error = check_pcm16_wav(sfIn);
+    if(!result.error.empty())
+        return;
+
+    LloydMaxQuantizer lm;
+    if(lloydMax){
+        lm = LloydMaxQuantizer::train(sfIn, bits, &buffers, stats);
+        sfIn = SndfileHandle { job.input }; // second pass
+    }
+
+    int channels = sfIn.channels();
+    int sample_rate = sfIn.samplerate();
+    sf_count_t total_frames = sfIn.frames();
+
+    if(log) *log << "Encoding " << job.input << " into " << job.output << " using " << bits << " bits per sample"
+                 << (lloydMax ? " (Lloyd-Max)" : "") << "...\n";
+
+    fstream out(job.output, ios::out | ios::binary | ios::trunc);
+    if(!out){
+        result.error = "cannot open output file";
+        return;
+    }
+    BitStream bs(out, STREAM_WRITE);
+
+    const QNTHeader h { static_cast<uint32_t>(sample_rate), static_cast<uint16_t>(channels), bits,
+                        static_cast<uint32_t>(total_frames), lloydMax };
+    write_qnt_header(bs, h, lm);
+    qnt_encode_samples(sfIn, bs, h, lm, &buffers, stats);
+    {
+        StageTimer t(stats, Stage::Flush);
+        bs.close();
+    }
+
+    const uint64_t samples = static_cast<uint64_t>(total_frames) * channels;
+    stats_count(stats, &Stats::files, 1);
+    stats_count(stats, &Stats::frames, static_cast<uint64_t>(total_frames));
+    stats_count(stats, &Stats::bytesIn, samples * sizeof(short));
+    stats_count(stats, &Stats::bitsOut, samples * bits);
+    stats_count(stats, &Stats::bytesOut, static_cast<uint64_t>(bs.tell()));
 
-static inline uint16_t sample_to_code(short sample, int bits){
-    int shifted = static_cast<int>(sample) + 32768;
-    return static_cast<uint16_t>(shifted >> (16 - bits));
+    result.frames = static_cast<size_t>(total_frames);
+    result.samplerate = sample_rate;
+    if(log) *log << "Done! Encoded " << total_frames << " frames.\n";
 }
 
 int main(int argc, char *argv[]) {
     if(argc < 5) {
-        cerr << "Usage: wav_quant_enc -b bits input.wav output.qnt\n";
+        cerr << "Usage: wav_quant_enc [ --stats json ] [ -lm ] -b bits input.wav output.qnt\n";
+        cerr << "       wav_quant_enc [ --stats json ] [ -j threads ] [ -lm ] -b bits -batch list.txt\n";
         cerr << "  bits: number of quantization bits (1..16).\n";
+        cerr << "  -lm: Lloyd-Max quantizer trained on each input (non-uniform levels, QNT2; 1..12 bits).\n";
+        cerr << "       Two passes: every input is reopened, so it must be a file ('-' is rejected).\n";
+        cerr << "  list.txt: one 'input.wav output.qnt' pair per line.\n";
+        cerr << "  --stats json: per-stage times and counters, as JSON on stderr.\n";
         return 1;
     }
 
     int bits { 0 };
-    for (int i=1; i<argc - 2; i++){
+    bool lloydMax { false };
+    string batchFile;
+    string statsFormat;
+    unsigned nThreads = max(1u, thread::hardware_concurrency());
+    for (int i=1; i<argc - 1; i++){
+        if(string(argv[i]) == "-batch") batchFile = argv[i+1];
+        if(string(argv[i]) == "-j") nThreads = static_cast<unsigned>(max(1, atoi(argv[i+1])));
+        if(string(argv[i]) == "--stats") statsFormat = argv[i+1];
+        if(string(argv[i]) == "-lm") lloydMax = true;
+    }
+    int lastOption = batchFile.empty() ? argc - 2 : argc;
+    for (int i=1; i<lastOption; i++){
         if(string(argv[i]) == "-b" && i+1 < argc){
             bits = atoi(argv[i+1]);
         }
@@ -44,48 +102,42 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    SndfileHandle sfIn { argv[argc-2] };
-    if(sfIn.error()){
-        cerr << "Error: invalid input file\n";
-        return 1;
-    }
-
-    if((sfIn.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV) {
-        cerr << "Error: file is not in WAV format\n";
+    if(lloydMax && bits > LloydMaxQuantizer::MAX_BITS){
+        cerr << "Error: -lm supports 1 to " << LloydMaxQuantizer::MAX_BITS << " bits\n";
         return 1;
     }
 
-    if((sfIn.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16) {
-        cerr << "Error: file is not in PCM_16 format\n";
+    if(!statsFormat.empty() && !parse_stats_format(statsFormat)){
+        cerr << "Error: --stats expects json\n";
         return 1;
     }
 
-    int channels = sfIn.channels();
-    int sample_rate = sfIn.samplerate();
-    sf_count_t total_frames = sfIn.frames();
-
-    cout << "Encoding " << argv[argc-2] << " into " << argv[argc-1] << " using " << bits << " bits per sample...\n";
-
-    fstream out(argv[argc-1], ios::out | ios::binary | ios::trunc);
-    BitStream bs(out, STREAM_WRITE);
-
-    bs.write_string("QNT1");
-    bs.write_n_bits(sample_rate, 32);
-    bs.write_n_bits(channels, 16);
-    bs.write_n_bits(bits, 8);
-    bs.write_n_bits(total_frames, 32);
-
-    sf_count_t frames_count;
-    vector<short> buffer(FRAMES_BUFFER_SIZE * channels);
-    while((frames_count = sfIn.readf(buffer.data(), FRAMES_BUFFER_SIZE))){
-        size_t count = frames_count * channels;
-        for (size_t i = 0; i < count; i++){
-            short q = quantize_sample(buffer[i], bits);
-            uint16_t code = sample_to_code(q, bits);
-            bs.write_n_bits(code, bits);
+    auto t0 = chrono::steady_clock::now();
+    int status;
+    vector<Stats> stats(batchFile.empty() ? 1 : nThreads); // one per worker
+    auto statsOf = [&](unsigned worker){ return statsFormat.empty() ? nullptr : &stats[worker]; };
+    if(!batchFile.empty()){
+        vector<ReaderBuffers> buffers(nThreads); // one per worker
+        status = batch_main(batchFile, nThreads, [&](const BatchJob& job, unsigned worker, BatchResult& result){
+            encode_file(job, bits, lloydMax, buffers[worker], statsOf(worker), nullptr, result);
+        });
+    } else {
+        ReaderBuffers buffers;
+        BatchResult result;
+        encode_file({ argv[argc-2], argv[argc-1] }, bits, lloydMax, buffers, statsOf(0), &cout, result);
+        if(!result.error.empty()){
+            cerr << "Error: " << result.error << "\n";
+            return 1;
         }
+        status = 0;
     }
 
-    cout << "Done! Encoded " << total_frames << " frames.\n";
-    return 0;
-}
\ No newline at end of file
+    if(!statsFormat.empty()){
+        Stats total;
+        for(const Stats& s : stats)
+            total.add(s);
+        double wall = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        total.write_json(cerr, "wav_quant_enc", static_cast<unsigned>(stats.size()), wall);
+    }
+    return status;
+}
@@ -0,0 +1,245 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <type_traits>
+#include <memory>
+#include <fftw3.h>
+#include <sndfile.hh>
+#include "wav_quant.h"
+#include "wav_cmp.h"
+#include "dct_codec.h"
+#include "audio_io.h"
+
+using namespace std;
+
+constexpr size_t FRAMES_BUFFER_SIZE = 65536;
+
+struct Options {
+    bool verbose = false;
+    bool sweepDCT = false;
+    size_t blockSize = 1024;
+    int coeffBits = 12;
+    string kArg;
+    string qArg = "8";
+};
+
+// One point of the dct_enc parameter grid
+struct DCTPoint {
+    DCTParams params;
+    Metrics<short> d;
+};
+
+static vector<double> parse_list(const string& arg) {
+    vector<double> v;
+    stringstream ss(arg);
+    string item;
+    while(getline(ss, item, ','))
+        if(!item.empty())
+            v.push_back(atof(item.c_str()));
+    return v;
+}
+
+// MSE, L_inf and SNR (dB), as wav_cmp prints them, of all channels together
+template <typename T>
+static void print_row(const Metrics<T>& m) {
+    long double mse = static_cast<long double>(m.sum_sq_error) / max(1LL, m.count_samples);
+    long double snr = snr_db(m);
+    cout << '\t' << static_cast<double>(mse) << '\t' << m.max_abs_error << '\t';
+    if(isinf(static_cast<double>(snr)))
+        cout << "inf\n";
+    else
+        cout << static_cast<double>(snr) << '\n';
+}
+
+// Metrics of "count" samples of all channels pooled (one "channel" for
+// accumulate_metrics(), so no MID metrics are computed)
+template <typename T>
+static void accumulate_all(const T* orig, const T* test, size_t count, double scale, Metrics<T>& m) {
+    vector<Metrics<T>> all(1);
+    Metrics<T> unused;
+    accumulate_metrics(orig, test, count, 1, scale, all, unused);
+    m.add(all[0]);
+}
+
+//------------------------------------------------------------------------------
+// DCT codec on every grid point, with the quantization and reconstruction of
+// dct_enc/dct_dec (dct_codec.h). The forward transform of each block is
+// computed once and reused by every point. PCM_16 mono only, as dct_enc.
+//------------------------------------------------------------------------------
+class DCTSweep {
+  private:
+    size_t blockSize;
+    vector<DCTPoint>& grid;
+    vector<double> coeffs, x;
+    vector<uint32_t> codes;
+    vector<short> rec;
+    fftw_plan planD, planI;
+
+  public:
+    DCTSweep(size_t blockSize, vector<DCTPoint>& grid)
+        : blockSize(blockSize), grid(grid), coeffs(blockSize), x(blockSize), codes(blockSize), rec(blockSize) {
+        planD = fftw_plan_r2r_1d(static_cast<int>(blockSize), coeffs.data(), coeffs.data(), FFTW_REDFT10, FFTW_ESTIMATE);
+        planI = fftw_plan_r2r_1d(static_cast<int>(blockSize), x.data(), x.data(), FFTW_REDFT01, FFTW_ESTIMATE);
+    }
+
+    DCTSweep(const DCTSweep&) = delete;
+    DCTSweep& operator=(const DCTSweep&) = delete;
+
+    ~DCTSweep() {
+        fftw_destroy_plan(planD);
+        fftw_destroy_plan(planI);
+    }
+
+    // A read of nFrames frames, a whole number of blocks but for the last one
+    // (zero padded, as dct_enc)
+    void add(const short* samples, size_t nFrames) {
+        for(size_t start = 0; start < nFrames; start += blockSize) {
+            size_t len = min(blockSize, nFrames - start);
+            for(size_t i = 0; i < blockSize; i++)
+                coeffs[i] = i < len ? static_cast<double>(samples[start + i]) : 0.0;
+            fftw_execute(planD);
+
+            for(auto& p : grid) {
+                dct_quantize(coeffs.data(), codes.data(), p.params);
+                dct_dequantize(codes.data(), x.data(), p.params);
+                fftw_execute(planI);
+                for(size_t i = 0; i < len; i++)
+                    rec[i] = dct_to_sample(x[i]);
+                accumulate_all(samples + start, rec.data(), len, 1.0, p.d);
+            }
+        }
+    }
+};
+
+// Reads the input once in its native sample type T: wav_quant at every bit
+// depth of the file and, for PCM_16 with -dct, the DCT grid
+template <typename T>
+static int sweep(SndfileHandle& sfhIn, const Options& opt, vector<DCTPoint>& grid) {
+    // Errors in LSBs of the file, as wav_cmp
+    const int maxBits = sample_bits(sfhIn.format());
+    const double scale = is_same_v<T, int> ? ldexp(1.0, maxBits - 32) : 1.0;
+
+    // Reads are a whole number of DCT blocks, so blocks never straddle two reads
+    const size_t channels = static_cast<size_t>(sfhIn.channels());
+    const size_t chunkFrames = opt.sweepDCT ? (FRAMES_BUFFER_SIZE + opt.blockSize - 1) / opt.blockSize * opt.blockSize
+                                            : FRAMES_BUFFER_SIZE;
+    BasicBlockReader<T> reader { sfhIn, chunkFrames };
+    AlignedBuffer<T> quantized(chunkFrames * channels);
+    vector<Metrics<T>> uniform(maxBits + 1);
+    unique_ptr<DCTSweep> dct;
+    if constexpr (is_same_v<T, short>)
+        if(opt.sweepDCT)
+            dct = make_unique<DCTSweep>(opt.blockSize, grid);
+
+    T* samples;
+    size_t nFrames;
+    while((nFrames = reader.next(samples))) {
+        const size_t count = nFrames * channels;
+
+        // Uniform quantizer: every bit depth on the same buffer
+        for(int bits = 1; bits <= maxBits; bits++) {
+            quantize_block(samples, quantized.data(), count, bits);
+            accumulate_all(samples, quantized.data(), count, scale, uniform[bits]);
+        }
+
+        if constexpr (is_same_v<T, short>)
+            if(dct)
+                dct->add(samples, nFrames);
+    }
+
+    cout << "# wav_quant\n";
+    cout << "bits\trate (bits/sample)\tMSE\tL_inf\tSNR (dB)\n";
+    for(int bits = maxBits; bits >= 1; bits--) {
+        cout << bits << '\t' << bits;
+        print_row(uniform[bits]);
+    }
+
+    if(opt.sweepDCT) {
+        cout << "# dct_enc (N=" << opt.blockSize << ", bits/coeff=" << opt.coeffBits << ")\n";
+        cout << "K\tstep\trate (bits/sample)\tMSE\tL_inf\tSNR (dB)\n";
+        for(const auto& p : grid) {
+            cout << p.params.keepK << '\t' << p.params.qStep << '\t'
+                 << static_cast<double>(p.params.keepK * opt.coeffBits) / opt.blockSize;
+            print_row(p.d);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+
+    if(argc < 2) {
+        cerr << "Usage: wav_rd_sweep [ -v ] [ -dct [ -bs N ] [ -k K1,K2,... ] [ -q step1,step2,... ] [ -b bits ] ] wavFileIn\n";
+        cerr << "  Prints MSE, L_inf and SNR of wav_quant for every bit depth of the input (1..16,\n";
+        cerr << "  up to 24 for PCM_24/FLOAT, 32 for PCM_32) and, with -dct, of dct_enc/dct_dec\n";
+        cerr << "  for every (K, step) pair (PCM_16 mono input only).\n";
+        return 1;
+    }
+
+    for(int i = 1; i < argc - 1; i++) if(string(argv[i]) == "-v") opt.verbose = true;
+    for(int i = 1; i < argc - 1; i++) if(string(argv[i]) == "-dct") opt.sweepDCT = true;
+    for(int i = 1; i + 1 < argc - 1; i++) if(string(argv[i]) == "-bs") opt.blockSize = static_cast<size_t>(atoi(argv[i+1]));
+    for(int i = 1; i + 1 < argc - 1; i++) if(string(argv[i]) == "-k") opt.kArg = argv[i+1];
+    for(int i = 1; i + 1 < argc - 1; i++) if(string(argv[i]) == "-q") opt.qArg = argv[i+1];
+    for(int i = 1; i + 1 < argc - 1; i++) if(string(argv[i]) == "-b") opt.coeffBits = atoi(argv[i+1]);
+
+    SndfileHandle sfhIn { argv[argc-1] };
+    string error = check_wav(sfhIn);
+    if(!error.empty()) {
+        cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    // DCT grid (defaults: K = N/4, step = 8, as dct_enc)
+    vector<DCTPoint> grid;
+    if(opt.sweepDCT) {
+        if(sfhIn.channels() != 1 || sample_type(sfhIn) != SampleType::Short) {
+            cerr << "Error: the DCT sweep needs a PCM_16 mono file (see wav_to_mono)\n";
+            return 1;
+        }
+        if(opt.blockSize < 1 || opt.coeffBits < 2 || opt.coeffBits > 24) {
+            cerr << "Error: invalid block size or bits\n";
+            return 1;
+        }
+        vector<double> ks = opt.kArg.empty() ? vector<double> { static_cast<double>(opt.blockSize / 4) }
+                                             : parse_list(opt.kArg);
+        vector<double> qs = parse_list(opt.qArg);
+        for(double k : ks) {
+            if(k < 1 || k > opt.blockSize) {
+                cerr << "Error: K must be in 1..N\n";
+                return 1;
+            }
+            for(double q : qs) {
+                if(q <= 0) {
+                    cerr << "Error: quantization steps must be positive\n";
+                    return 1;
+                }
+                DCTPoint p;
+                p.params.blockSize = opt.blockSize;
+                p.params.keepK = static_cast<size_t>(k);
+                p.params.coeffBits = opt.coeffBits;
+                p.params.qStep = static_cast<float>(q);
+                grid.push_back(p);
+            }
+        }
+    }
+
+    if(opt.verbose) {
+        cout << "Input file has:\n";
+        cout << '\t' << sfhIn.frames() << " frames\n";
+        cout << '\t' << sfhIn.samplerate() << " samples per second\n";
+        cout << '\t' << sfhIn.channels() << " channels\n";
+        if(opt.sweepDCT)
+            cout << "DCT grid: N=" << opt.blockSize << ", bits/coeff=" << opt.coeffBits << ", " << grid.size()
+                 << " (K, step) points\n";
+    }
+
+    return with_sample_type(sample_type(sfhIn), [&](auto zero) {
+        return sweep<decltype(zero)>(sfhIn, opt, grid);
+    });
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <string>
+#include <sndfile.hh>
+#include "audio_io.h"
+#include "resample.h"
+
+using namespace std;
+
+constexpr size_t FRAMES_BUFFER_SIZE = 65536;
+constexpr size_t MAX_BANK_SIZE = 1 << 24; // filter coefficients (64 MB)
+
+static void usage() {
+    cerr << "Usage: wav_resample [ -v ] [ -q taps ] [ -16 ] [ -raw channels:samplerate ] [ -lat ] -r rate <input.wav> <output.wav>\n";
+    cerr << "  -r rate: output sample rate (Hz)\n";
+    cerr << "  -q taps: filter taps per phase (default = 64; more: sharper and slower)\n";
+    cerr << "  -16: write PCM_16 whatever the input format (e.g. for wav_quant_enc, dct_enc)\n";
+    cerr << "  -raw channels:samplerate: raw PCM_16 input and output instead of WAV\n";
+    cerr << "  -lat: report the worst-case block processing latency (stderr)\n";
+    cerr << "  '-' as input/output file: stdin/stdout\n";
+}
+
+//------------------------------------------------------------------------------
+// Streams the input (native type T) through the resampler into samples of
+// type U (T, or short with -16); returns the number of output frames
+//------------------------------------------------------------------------------
+template <typename T, typename U>
+static size_t resample_stream(SndfileHandle& sfhIn, SndfileHandle& sfhOut, PolyphaseResampler& rs,
+                              BlockLatency& latency) {
+    const size_t channels = static_cast<size_t>(sfhIn.channels());
+    const size_t maxOut = max(rs.max_output(FRAMES_BUFFER_SIZE), rs.max_output(rs.taps_per_phase()));
+    AlignedBuffer<float> in(FRAMES_BUFFER_SIZE * channels);
+    AlignedBuffer<float> out(maxOut * channels);
+    AlignedBuffer<U> samplesOut(maxOut * channels);
+    BasicBlockReader<T> reader { sfhIn, FRAMES_BUFFER_SIZE };
+    BlockWriter writer { sfhOut };
+
+    T* samples;
+    size_t nFrames;
+    while((nFrames = reader.next(samples))) {
+        latency.start();
+        samples_to_float(samples, in.data(), nFrames * channels);
+        size_t n = rs.process(in.data(), nFrames, out.data());
+        float_to_samples(out.data(), samplesOut.data(), n * channels);
+        latency.stop();
+        writer.write(samplesOut.data(), n);
+    }
+    size_t n = rs.flush(out.data());
+    float_to_samples(out.data(), samplesOut.data(), n * channels);
+    writer.write(samplesOut.data(), n);
+    return writer.frames();
+}
+
+int main(int argc, char* argv[]) {
+    bool verbose = false;
+    bool to16 = false;
+    bool reportLatency = false;
+    int outRate = 0;
+    size_t taps = 64;
+    StreamFormat streamFmt;
+
+    if(argc < 5) {
+        usage();
+        return 1;
+    }
+    for(int n = 1; n < argc - 2; n++) {
+        string arg = argv[n];
+        if(arg == "-v")
+            verbose = true;
+        else if(arg == "-16")
+            to16 = true;
+        else if(arg == "-lat")
+            reportLatency = true;
+        else if(arg == "-r" || arg == "-q" || arg == "-raw") {
+            if(n + 1 >= argc - 2) { // the value would be the input file
+                cerr << "Error: " << arg << " expects a value\n";
+                return 1;
+            }
+            const char* value = argv[++n];
+            if(arg == "-r")
+                outRate = atoi(value);
+            else if(arg == "-q")
+                taps = static_cast<size_t>(max(1, atoi(value)));
+            else if(!streamFmt.parse(value)) {
+                cerr << "Error: -raw expects channels:samplerate\n";
+                return 1;
+            }
+        }
+    }
+    if(outRate <= 0) {
+        cerr << "Error: -r expects the output sample rate\n";
+        return 1;
+    }
+
+    SndfileHandle sfhIn = open_input(argv[argc-2], streamFmt);
+    string error = check_wav(sfhIn, true);
+    if(!error.empty()) {
+        cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    if(PolyphaseResampler::bank_size(sfhIn.samplerate(), outRate, taps) > MAX_BANK_SIZE) {
+        cerr << "Error: " << sfhIn.samplerate() << " Hz -> " << outRate << " Hz with " << taps
+             << " taps needs too large a filter bank\n";
+        return 1;
+    }
+    PolyphaseResampler rs(sfhIn.samplerate(), outRate, sfhIn.channels(), taps);
+
+    int format = sfhIn.format();
+    if(to16)
+        format = (format & ~SF_FORMAT_SUBMASK) | SF_FORMAT_PCM_16;
+    SndfileHandle sfhOut = open_output(argv[argc-1], streamFmt, format, sfhIn.channels(), outRate);
+    if(sfhOut.error()) {
+        cerr << "Error: invalid output file\n";
+        return 1;
+    }
+
+    // stdout may be carrying the audio stream
+    ostream& msg = is_stdio(argv[argc-1]) ? cerr : cout;
+    if(verbose)
+        msg << "Resampling " << sfhIn.samplerate() << " Hz -> " << outRate << " Hz (x " << rs.up() << "/"
+            << rs.down() << "), " << rs.taps_per_phase() << " taps per phase\n";
+
+    BlockLatency latency;
+    size_t frames = with_sample_type(sample_type(sfhIn), [&](auto zero) {
+        using T = decltype(zero);
+        return to16 ? resample_stream<T, short>(sfhIn, sfhOut, rs, latency)
+                    : resample_stream<T, T>(sfhIn, sfhOut, rs, latency);
+    });
+
+    if(verbose)
+        msg << "Wrote " << frames << " frames\n";
+    if(reportLatency)
+        latency.report(cerr, FRAMES_BUFFER_SIZE, sfhIn.samplerate());
+    return 0;
+}
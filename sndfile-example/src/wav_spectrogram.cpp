@@ -0,0 +1,247 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <sndfile.hh>
+#include "audio_io.h"
+#include "stft.h"
+
+using namespace std;
+
+constexpr size_t FRAMES_BUFFER_SIZE = 65536;
+
+static void usage() {
+    cerr << "Usage: wav_spectrogram [ -v ] [ -n fftSize ] [ -hop samples ] [ -w hann|hamming|rect ] [ -c channel|mix ]\n";
+    cerr << "                       [ -lin ] [ -tsv ] [ -j threads ] [ -raw channels:samplerate ] <input.wav> <output>\n";
+    cerr << "  -n fftSize: samples per frame (default = 1024)\n";
+    cerr << "  -hop samples: distance between frames (default = fftSize / 4)\n";
+    cerr << "  -w window: hann (default), hamming or rect\n";
+    cerr << "  -c channel|mix: channel to analyse, or the mean of all channels (default = mix)\n";
+    cerr << "  -lin: linear magnitudes (default: dBFS)\n";
+    cerr << "  -tsv: text output, one row per frame (default: binary WSP1, see README)\n";
+    cerr << "  -j threads: default = all cores\n";
+    cerr << "  '-' as input/output file: stdin/stdout\n";
+}
+
+//------------------------------------------------------------------------------
+// Output: binary ("WSP1", then samplerate, fftSize, hop, bins and flags as
+// u32, then one row of bins float32 per frame, little-endian) or TSV (a
+// header with the frequency of each bin, then the time of the center of each
+// frame and its row)
+//------------------------------------------------------------------------------
+class SpectrogramWriter {
+  private:
+    ostream& os;
+    bool tsv;
+    size_t nBins;
+    double frameSeconds, hopSeconds;
+    size_t frames = 0;
+
+    void write_u32(uint32_t v) {
+        unsigned char b[4] = { static_cast<unsigned char>(v), static_cast<unsigned char>(v >> 8),
+                               static_cast<unsigned char>(v >> 16), static_cast<unsigned char>(v >> 24) };
+        os.write(reinterpret_cast<const char*>(b), 4);
+    }
+
+  public:
+    SpectrogramWriter(ostream& os, bool tsv, int samplerate, size_t n, size_t hop, size_t nBins, bool dB)
+        : os(os), tsv(tsv), nBins(nBins), frameSeconds(0.5 * n / samplerate),
+          hopSeconds(static_cast<double>(hop) / samplerate) {
+        if(tsv) {
+            os << "time";
+            for(size_t k = 0; k < nBins; k++)
+                os << '\t' << static_cast<double>(k) * samplerate / n;
+            os << '\n';
+        } else {
+            os.write("WSP1", 4);
+            write_u32(static_cast<uint32_t>(samplerate));
+            write_u32(static_cast<uint32_t>(n));
+            write_u32(static_cast<uint32_t>(hop));
+            write_u32(static_cast<uint32_t>(nBins));
+            write_u32(dB ? 1 : 0);
+        }
+    }
+
+    void write(const float* mags, size_t nFrames) {
+        if(tsv) {
+            for(size_t f = 0; f < nFrames; f++) {
+                os << (frames + f) * hopSeconds + frameSeconds;
+                for(size_t k = 0; k < nBins; k++)
+                    os << '\t' << mags[f * nBins + k];
+                os << '\n';
+            }
+        } else {
+            static_assert(sizeof(float) == 4);
+            os.write(reinterpret_cast<const char*>(mags), static_cast<streamsize>(nFrames * nBins * sizeof(float)));
+        }
+        frames += nFrames;
+    }
+
+    size_t count() const { return frames; }
+    bool ok() const { return static_cast<bool>(os); }
+};
+
+//------------------------------------------------------------------------------
+// Reads the input (native type T) block by block into a mono signal at full
+// scale 1 (one channel, or the mean of all of them), and analyses every frame
+// that fits; the samples of the frames still to come are kept for the next
+// block. At the end, a last zero-padded frame covers the remaining samples.
+// Returns the number of input frames.
+//------------------------------------------------------------------------------
+template <typename T>
+static size_t spectrogram_stream(SndfileHandle& sfhIn, int channel, size_t n, size_t hop, const STFT& stft,
+                                 ThreadPool& pool, vector<ScratchArena>& arenas, SpectrogramWriter& writer) {
+    const size_t channels = static_cast<size_t>(sfhIn.channels());
+    const size_t blockFrames = max(FRAMES_BUFFER_SIZE, 2 * pool.size() * STFT::CHUNK * hop);
+    const double scale = float_units_per_sample<T>() / 32768.0 / (channel < 0 ? channels : 1);
+    BasicBlockReader<T> reader { sfhIn, blockFrames };
+    AlignedBuffer<double> signal(blockFrames + n);
+    AlignedBuffer<float> mags((blockFrames + n) / hop * stft.bins() + stft.bins());
+    size_t buffered = 0;
+    size_t total = 0;
+
+    T* samples;
+    size_t nFrames;
+    while((nFrames = reader.next(samples))) {
+        double* s = signal.data() + buffered;
+        for(size_t i = 0; i < nFrames; i++) {
+            double v = 0.0;
+            if(channel < 0)
+                for(size_t c = 0; c < channels; c++)
+                    v += samples[i * channels + c];
+            else
+                v = samples[i * channels + channel];
+            s[i] = v * scale;
+        }
+        buffered += nFrames;
+        total += nFrames;
+
+        size_t count = stft.frames(buffered);
+        if(count) {
+            stft.analyze(signal.data(), count, mags.data(), pool, arenas);
+            writer.write(mags.data(), count);
+            buffered -= count * hop;
+            memmove(signal.data(), signal.data() + count * hop, buffered * sizeof(double));
+        }
+    }
+
+    // Samples after the last frame (or a stream shorter than one frame)
+    if(buffered > (writer.count() ? n - hop : 0)) {
+        fill(signal.data() + buffered, signal.data() + n, 0.0);
+        stft.analyze(signal.data(), 1, mags.data(), pool, arenas);
+        writer.write(mags.data(), 1);
+    }
+    return total;
+}
+
+int main(int argc, char* argv[]) {
+    bool verbose = false;
+    bool dB = true;
+    bool tsv = false;
+    size_t n = 1024;
+    size_t hop = 0;
+    Window window = Window::Hann;
+    string channelArg = "mix";
+    unsigned nThreads = max(1u, thread::hardware_concurrency());
+    StreamFormat streamFmt;
+
+    if(argc < 3) {
+        usage();
+        return 1;
+    }
+    for(int i = 1; i < argc - 2; i++) {
+        string arg = argv[i];
+        if(arg == "-v")
+            verbose = true;
+        else if(arg == "-lin")
+            dB = false;
+        else if(arg == "-tsv")
+            tsv = true;
+        else if(arg == "-n")
+            n = static_cast<size_t>(max(0, atoi(argv[++i])));
+        else if(arg == "-hop")
+            hop = static_cast<size_t>(max(0, atoi(argv[++i])));
+        else if(arg == "-c")
+            channelArg = argv[++i];
+        else if(arg == "-j")
+            nThreads = static_cast<unsigned>(max(1, atoi(argv[++i])));
+        else if(arg == "-w") {
+            if(!parse_window(argv[++i], window)) {
+                cerr << "Error: -w expects hann, hamming or rect\n";
+                return 1;
+            }
+        } else if(arg == "-raw") {
+            if(!streamFmt.parse(argv[++i])) {
+                cerr << "Error: -raw expects channels:samplerate\n";
+                return 1;
+            }
+        }
+    }
+    if(hop == 0)
+        hop = max<size_t>(1, n / 4);
+    if(n < 2 || hop > n) {
+        cerr << "Error: -n expects at least 2 samples and -hop at most fftSize\n";
+        return 1;
+    }
+
+    SndfileHandle sfhIn = open_input(argv[argc-2], streamFmt);
+    string error = check_wav(sfhIn, true);
+    if(!error.empty()) {
+        cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    int channel = -1;
+    if(channelArg != "mix") {
+        try {
+            channel = stoi(channelArg);
+        } catch(...) {
+            channel = -2;
+        }
+        if(channel < 0 || channel >= sfhIn.channels()) {
+            cerr << "Error: invalid channel requested\n";
+            return 1;
+        }
+    }
+
+    const string outName = argv[argc-1];
+    ofstream file;
+    if(!is_stdio(outName)) {
+        file.open(outName, ios::binary | ios::trunc);
+        if(!file) {
+            cerr << "Error: invalid output file\n";
+            return 1;
+        }
+    }
+    ostream& out = is_stdio(outName) ? cout : file;
+    ostream& msg = is_stdio(outName) ? cerr : cout;
+
+    auto start = chrono::steady_clock::now();
+    ThreadPool pool(nThreads);
+    vector<ScratchArena> arenas(pool.size());
+    STFT stft(n, hop, window, dB);
+    SpectrogramWriter writer(out, tsv, sfhIn.samplerate(), n, hop, stft.bins(), dB);
+    size_t frames = with_sample_type(sample_type(sfhIn), [&](auto zero) {
+        return spectrogram_stream<decltype(zero)>(sfhIn, channel, n, hop, stft, pool, arenas, writer);
+    });
+    out.flush();
+    if(!writer.ok()) {
+        cerr << "Error: cannot write output\n";
+        return 1;
+    }
+
+    if(verbose) {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double audioSeconds = static_cast<double>(frames) / sfhIn.samplerate();
+        msg << "Frames: " << writer.count() << " x " << stft.bins() << " bins ("
+            << static_cast<double>(sfhIn.samplerate()) / n << " Hz, " << 1000.0 * hop / sfhIn.samplerate()
+            << " ms apart)\n";
+        msg << "Time: " << seconds << " s (" << audioSeconds / seconds << " x real time)\n";
+    }
+    return 0;
+}
@@ -1,32 +1,65 @@
 #include <sndfile.hh>
 #include <vector>
 #include <iostream>
-#include <cmath>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include "audio_io.h"
+#include "downmix.h"
 using namespace std;
 
+constexpr size_t FRAMES_BUFFER_SIZE = 65536;
+
+// "-m itu" (5.1 only) or "-m w1,w2,...,wC"; returns false if invalid
+static bool parse_matrix(const string& arg, int channels, vector<float>& weights){
+    if(arg == "itu"){
+        if(channels != 6) return false;
+        weights = itu_51_weights();
+        return true;
+    }
+    stringstream ss(arg);
+    string item;
+    weights.clear();
+    while(getline(ss, item, ',')) weights.push_back(static_cast<float>(atof(item.c_str())));
+    return static_cast<int>(weights.size()) == channels;
+}
+
 int main(int argc, char* argv[]){
     if(argc < 3){
-        cerr << "Usage: wav_to_mono input.wav output.wav\n";
+        cerr << "Usage: wav_to_mono [ -m itu | -m w1,w2,...,wC ] input.wav output.wav\n";
+        cerr << "  default: mean of the channels, rounded\n";
+        cerr << "  -m itu: ITU-R BS.775 mono downmix of 5.1 (L R C LFE Ls Rs), LFE dropped\n";
+        cerr << "  -m w1,...,wC: one weight per channel (result saturated)\n";
         return 1;
     }
-    SndfileHandle in{argv[1]};
-    if(in.error()){ cerr << "Error: cannot open input" << endl; return 1; }
-    if((in.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV || (in.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16){
-        cerr << "Error: input must be WAV PCM_16" << endl; return 1; }
+    string matrix;
+    for(int i=1;i<argc-2;i++) if(string(argv[i])=="-m") matrix = argv[i+1];
+
+    SndfileHandle in{argv[argc-2]};
+    string error = check_pcm16_wav(in);
+    if(!error.empty()){ cerr << "Error: " << error << endl; return 1; }
     int C = in.channels();
-    if(C == 1){ cerr << "Input already mono; copying" << endl; }
-    vector<short> buf(static_cast<size_t>(in.frames()) * C);
-    in.readf(buf.data(), in.frames());
-    vector<short> out(static_cast<size_t>(in.frames()));
-    for(sf_count_t n=0;n<in.frames();++n){
-        long sum=0;
-        for(int c=0;c<C;++c) sum += buf[static_cast<size_t>(n)*C + c];
-        long v = lround(static_cast<double>(sum) / C);
-        if(v>32767) v=32767; if(v<-32768) v=-32768;
-        out[static_cast<size_t>(n)] = static_cast<short>(v);
+    vector<float> weights;
+    if(!matrix.empty() && !parse_matrix(matrix, C, weights)){
+        cerr << "Error: -m expects itu (5.1 input) or " << C << " weights" << endl;
+        return 1;
     }
-    SndfileHandle outH{argv[2], SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_PCM_16, 1, in.samplerate()};
+    if(C == 1){ cerr << "Input already mono; copying" << endl; }
+    SndfileHandle outH{argv[argc-1], SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_PCM_16, 1, in.samplerate()};
     if(outH.error()){ cerr << "Error: cannot open output" << endl; return 1; }
-    outH.writef(out.data(), in.frames());
+
+    // Block by block: memory does not depend on the input length
+    BlockReader reader{in, FRAMES_BUFFER_SIZE};
+    BlockWriter writer{outH};
+    AlignedBuffer<short> out(FRAMES_BUFFER_SIZE);
+    short* buf;
+    size_t nFrames;
+    while((nFrames = reader.next(buf))){
+        if(!weights.empty()) downmix_weighted(buf, C, weights.data(), nFrames, out.data());
+        else if(C == 1) copy(buf, buf + nFrames, out.data());
+        else downmix_mean(buf, C, nFrames, out.data());
+        writer.write(out.data(), nFrames);
+    }
+    if(!writer.ok()){ cerr << "Error: cannot write output" << endl; return 1; }
     return 0;
 }
@@ -0,0 +1,31 @@
+#!/usr/bin/env python3
+import sys
+import numpy as np
+import matplotlib.pyplot as plt
+
+if len(sys.argv) < 2:
+    print("Usage: python3 plot_spectrogram.py <spectrogram_file (binary, from wav_spectrogram)>")
+    sys.exit(1)
+
+# Header: "WSP1", then samplerate, fftSize, hop, bins, flags (u32, little-endian)
+with open(sys.argv[1], 'rb') as f:
+    if f.read(4) != b'WSP1':
+        print("Error: not a wav_spectrogram file")
+        sys.exit(1)
+    samplerate, n, hop, bins, flags = np.frombuffer(f.read(20), dtype='<u4')
+    mags = np.frombuffer(f.read(), dtype='<f4').reshape(-1, bins)
+
+if not flags & 1:
+    mags = 20 * np.log10(np.maximum(mags, 1e-10))  # linear magnitudes -> dBFS
+
+# Rows are frames; plot time on x, frequency on y
+seconds = (len(mags) * hop + n) / samplerate
+plt.figure(figsize=(12, 6))
+plt.imshow(mags.T, origin='lower', aspect='auto', cmap='magma', vmin=mags.max() - 100,
+           extent=[0, seconds, 0, samplerate / 2])
+plt.colorbar(label="Magnitude (dBFS)")
+plt.title("Spectrogram")
+plt.xlabel("Time (s)")
+plt.ylabel("Frequency (Hz)")
+plt.tight_layout()
+plt.show()